@@ -0,0 +1,255 @@
+#include <algorithm>
+#include <cmath>
+#include <float.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <utility>
+#include <vector>
+
+#include "KDBallTreeClass.h"
+#include "KDFlatTreeClass.h"
+#include "KDHeapStoreClass.h"
+#include "KDLeafIndexClass.h"
+#include "KDNeighboursClass.h"
+
+// Builds the tree over the N units of t_dt, stored unit major. The levels are
+// optional, see KDFlatTree::KDFlatTree.
+KDBallTree::KDBallTree(
+  const double* t_dt,
+  const size_t t_N,
+  const size_t t_p,
+  const size_t t_bucketSize,
+  const size_t* t_levels
+) : KDFlatTree(t_N, t_p, t_bucketSize) {
+  centers.reserve(nodes.capacity() * p);
+  radii.reserve(nodes.capacity());
+
+  std::vector<std::pair<double, size_t>> projections(N);
+  std::vector<double> scratch(p * p + 2 * p);
+  BuildNode(t_dt, 0, N, projections, scratch.data());
+
+  SetLeaves(t_dt, t_levels, 1);
+  SetBoxes();
+}
+
+KDBallTree::~KDBallTree() {}
+
+// Builds the node of the units ids[start, end), and its children, and returns
+// the index of the node. The units are split in two halves at the median of
+// their projections on the principal direction of the units, i.e. the
+// direction of largest variance, found by power iteration from the direction
+// of the unit farthest from the centroid. Ties are split by id, thus the tree
+// is deterministic. The scratch holds p * p + 2 * p values.
+size_t KDBallTree::BuildNode(
+  const double* data,
+  const size_t start,
+  const size_t end,
+  std::vector<std::pair<double, size_t>>& projections,
+  double* scratch
+) {
+  const size_t iterations = 8;
+  size_t index = nodes.size();
+  nodes.push_back(KDFlatNode{0.0, KDFlatNode::terminal, 0, start, end, SIZE_MAX});
+  centers.resize(centers.size() + p, 0.0);
+  radii.push_back(0.0);
+
+  double* center = centers.data() + index * p;
+  for (size_t i = start; i < end; i++) {
+    for (size_t k = 0; k < p; k++)
+      center[k] += data[ids[i] * p + k];
+  }
+
+  for (size_t k = 0; k < p; k++)
+    center[k] /= (double)(end - start);
+
+  // The radius, and the unit farthest from the centroid
+  double radius = 0.0;
+  size_t farthest = ids[start];
+  for (size_t i = start; i < end; i++) {
+    double distance = 0.0;
+    for (size_t k = 0; k < p; k++) {
+      double temp = data[ids[i] * p + k] - center[k];
+      distance += temp * temp;
+    }
+
+    if (distance > radius) {
+      radius = distance;
+      farthest = ids[i];
+    }
+  }
+
+  radii[index] = std::sqrt(radius);
+
+  if (end - start <= bucketSize || radius == 0.0)
+    return index;
+
+  double* covariance = scratch;
+  double* direction = scratch + p * p;
+  double* product = scratch + p * p + p;
+
+  std::fill(covariance, covariance + p * p, 0.0);
+  for (size_t i = start; i < end; i++) {
+    const double* unit = data + ids[i] * p;
+    for (size_t k = 0; k < p; k++) {
+      for (size_t l = 0; l < p; l++)
+        covariance[k * p + l] += (unit[k] - center[k]) * (unit[l] - center[l]);
+    }
+  }
+
+  for (size_t k = 0; k < p; k++)
+    direction[k] = data[farthest * p + k] - center[k];
+
+  for (size_t iteration = 0; iteration < iterations; iteration++) {
+    double norm = 0.0;
+    for (size_t k = 0; k < p; k++) {
+      product[k] = 0.0;
+      for (size_t l = 0; l < p; l++)
+        product[k] += covariance[k * p + l] * direction[l];
+
+      norm += product[k] * product[k];
+    }
+
+    norm = std::sqrt(norm);
+    if (!(norm > 0.0))
+      break;
+
+    for (size_t k = 0; k < p; k++)
+      direction[k] = product[k] / norm;
+  }
+
+  for (size_t i = start; i < end; i++) {
+    double projection = 0.0;
+    for (size_t k = 0; k < p; k++)
+      projection += (data[ids[i] * p + k] - center[k]) * direction[k];
+
+    projections[i] = std::make_pair(projection, ids[i]);
+  }
+
+  size_t middle = start + (end - start) / 2;
+  std::nth_element(projections.begin() + start, projections.begin() + middle, projections.begin() + end);
+
+  for (size_t i = start; i < end; i++)
+    ids[i] = projections[i].second;
+
+  BuildNode(data, start, middle, projections, scratch);
+  size_t right = BuildNode(data, middle, end, projections, scratch);
+  nodes[index].split = 0;
+  nodes[index].right = right;
+
+  return index;
+}
+
+// Finds the neighbours of unit among the units with a level of at most
+// maxLevel. The neighbours are left in the heap of the store, see
+// KDHeapStore::SortNeighbours
+void KDBallTree::FindNeighbours(KDHeapStore* store, const double* unit, const size_t maxLevel) {
+  store->Reset();
+
+  KDBallStack stack;
+  SearchLeavesForNeighbours(this, store, unit, maxLevel, &stack, nullptr);
+  return;
+}
+
+// Finds the neighbours of all units with a level of at most maxLevel, see
+// KDLeafIndex::FindAllNeighboursByLeaf
+void KDBallTree::FindAllNeighbours(
+  KDNeighbours* result,
+  const size_t maxSize,
+  const size_t maxLevel,
+  const size_t nThreads
+) {
+  FindAllNeighboursByLeaf(this, result, maxSize, maxLevel, nThreads);
+  return;
+}
+
+// A lower bound of the squared distance from the unit to the units of a node:
+// the larger of the distances to the ball and to the bounding box of the node.
+// The distance to the ball is lowered by a margin for the rounding of the
+// distance to the centroid, so that no ties are lost.
+double KDBallTree::BallDistance(const double* unit, const size_t index) {
+  const double* center = centers.data() + index * p;
+  const double* box = boxes.data() + index * 2 * p;
+  double distance = 0.0;
+  double boxDistance = 0.0;
+
+  for (size_t k = 0; k < p; k++) {
+    double temp = unit[k] - center[k];
+    distance += temp * temp;
+
+    temp = 0.0;
+    if (unit[k] < box[k])
+      temp = box[k] - unit[k];
+    else if (unit[k] > box[p + k])
+      temp = unit[k] - box[p + k];
+
+    boxDistance += temp * temp;
+  }
+
+  distance = std::sqrt(distance);
+  double gap = distance - radii[index] - 16.0 * DBL_EPSILON * (distance + radii[index]);
+
+  if (gap > 0.0 && gap * gap > boxDistance)
+    return gap * gap;
+
+  return boxDistance;
+}
+
+// Starts a search at the root
+void KDBallTree::StartSearch(const double* unit, KDBallStack* stack) {
+  stack->nodes.resize(0);
+  stack->nodes.push_back(std::make_pair((size_t)0, BallDistance(unit, 0)));
+  return;
+}
+
+// Finds the next leaf of a search, traversing the tree depth first, nearest
+// node first, from the explicit stack. The bound of a node is BallDistance. A
+// node is skipped if it is farther away than the farthest neighbour. In
+// approximate searches, the distances are scaled by pruneFactor.
+bool KDBallTree::NextLeaf(
+  KDHeapStore* store,
+  const double* unit,
+  const size_t maxLevel,
+  KDBallStack* stack,
+  size_t* start,
+  size_t* end,
+  double* bound
+) {
+  while (stack->nodes.size() > 0) {
+    size_t index = stack->nodes.back().first;
+    double distance = stack->nodes.back().second;
+    stack->nodes.pop_back();
+
+    // The node is farther away than all neighbours
+    if (store->SizeFulfilled() && distance * pruneFactor > store->MaximumDistance())
+      continue;
+
+    const KDFlatNode& node = nodes[index];
+
+    // No unit of the node has a level of at most maxLevel
+    if (node.minLevel > maxLevel)
+      continue;
+
+    stack->visitedNodes += 1;
+
+    if (node.split == KDFlatNode::terminal) {
+      *start = node.start;
+      *end = node.end;
+      *bound = distance;
+      return true;
+    }
+
+    // Push the far child first, so that the near child is visited next
+    double leftDistance = BallDistance(unit, index + 1);
+    double rightDistance = BallDistance(unit, node.right);
+
+    if (leftDistance <= rightDistance) {
+      stack->nodes.push_back(std::make_pair(node.right, rightDistance));
+      stack->nodes.push_back(std::make_pair(index + 1, leftDistance));
+    } else {
+      stack->nodes.push_back(std::make_pair(index + 1, leftDistance));
+      stack->nodes.push_back(std::make_pair(node.right, rightDistance));
+    }
+  }
+
+  return false;
+}
@@ -0,0 +1,66 @@
+#ifndef KDBALLTREECLASS_HEADER
+#define KDBALLTREECLASS_HEADER
+
+#include <stddef.h>
+#include <utility>
+#include <vector>
+
+#include "KDFlatTreeClass.h"
+#include "KDHeapStoreClass.h"
+#include "KDLeafIndexClass.h"
+#include "KDNeighboursClass.h"
+
+// The explicit stack of the searches of KDBallTree, its Cursor: the nodes left
+// to visit, with a lower bound of the squared distance from the unit to their
+// units. Also counts the nodes and leaves visited by the searches using the
+// stack.
+struct KDBallStack {
+  std::vector<std::pair<size_t, double>> nodes = std::vector<std::pair<size_t, double>>(0);
+  size_t visitedNodes = 0;
+  size_t visitedLeaves = 0;
+};
+
+// A ball tree (metric tree), stored as KDFlatTree, with the same nodes, leaves
+// and bounding boxes. It differs only in its split and in the lower bound of
+// the distance to a node: each node also keeps the centroid of its units and
+// the radius of the smallest ball around the centroid that contains them, and
+// is split in two halves along the principal direction of its units. As the
+// splits and balls are not aligned with the axes, they can keep their pruning
+// power with many, correlated, dimensions, where the cells of a k-d tree do
+// not. The split dimension and value of the nodes are not used, but the
+// terminal split marks the leaves. The tree is immutable once built.
+class KDBallTree : protected KDFlatTree {
+  friend class KDLeafIndex;
+
+public:
+  typedef KDBallStack Cursor;
+
+  std::vector<double> centers = std::vector<double>(0); // Per node, p coordinates
+  std::vector<double> radii = std::vector<double>(0); // Per node
+
+public:
+  KDBallTree(const double*, const size_t, const size_t, const size_t, const size_t*);
+  ~KDBallTree();
+
+  using KDLeafIndex::GetSize;
+  using KDLeafIndex::SetApproximation;
+
+private:
+  size_t BuildNode(
+    const double*,
+    const size_t,
+    const size_t,
+    std::vector<std::pair<double, size_t>>&,
+    double*
+  );
+
+public:
+  void FindNeighbours(KDHeapStore*, const double*, const size_t);
+  void FindAllNeighbours(KDNeighbours*, const size_t, const size_t, const size_t);
+private:
+  double BallDistance(const double*, const size_t);
+  void StartSearch(const double*, KDBallStack*);
+  bool NextLeaf(KDHeapStore*, const double*, const size_t, KDBallStack*, size_t*, size_t*, double*);
+};
+
+#endif
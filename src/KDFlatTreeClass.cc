@@ -0,0 +1,653 @@
+#include <algorithm>
+#include <chrono>
+#include <float.h>
+#include <stddef.h>
+#include <stdexcept>
+#include <stdint.h>
+#include <vector>
+
+#include "KDFlatTreeClass.h"
+#include "KDHeapStoreClass.h"
+#include "KDLeafIndexClass.h"
+#include "KDNeighboursClass.h"
+#include "KDTreeSplitMethod.h"
+
+const size_t KDFlatNode::terminal;
+
+// Builds the tree over the N units of t_dt, stored unit major. The levels are
+// optional. If set, each node keeps the smallest level of its units, so that
+// the searches can be restricted to the units of at most some level. The tree
+// is built by nThreads threads, and does not depend on the number of threads.
+KDFlatTree::KDFlatTree(
+  double* t_dt,
+  const size_t t_N,
+  const size_t t_p,
+  const size_t t_bucketSize,
+  const KDTreeSplitMethod t_method,
+  const size_t* t_levels,
+  const size_t nThreads
+) : KDFlatTree(t_N, t_p, t_bucketSize) {
+  method = t_method;
+
+  // The cell of the root is the bounding box of all units
+  std::vector<double> scratch(4 * p);
+  double* cell = scratch.data();
+  std::fill(cell, cell + p, DBL_MAX);
+  std::fill(cell + p, cell + 2 * p, -DBL_MAX);
+  for (size_t i = 0; i < N; i++) {
+    for (size_t k = 0; k < p; k++) {
+      double value = t_dt[i * p + k];
+      if (value < cell[k])
+        cell[k] = value;
+      if (value > cell[p + k])
+        cell[p + k] = value;
+    }
+  }
+
+  // Subtrees larger than the threshold are built as separate tasks
+  size_t taskThreshold = nThreads > 1 ? std::max(N / (8 * nThreads), (size_t)4096) : N + 1;
+
+  #ifdef _OPENMP
+  #pragma omp parallel num_threads(nThreads)
+  #endif
+  {
+    #ifdef _OPENMP
+    #pragma omp single
+    #endif
+    BuildNode(nodes, t_dt, 0, N, 0, cell, taskThreshold);
+  }
+
+  SetLeaves(t_dt, t_levels, nThreads);
+  SetBoxes();
+}
+
+// Sizes the arrays of a tree over N units, with the ids in order, but without
+// nodes. Used by the trees that share the nodes of KDFlatTree, but are built
+// differently, see KDBallTree.
+KDFlatTree::KDFlatTree(const size_t t_N, const size_t t_p, const size_t t_bucketSize) {
+  N = t_N;
+  p = t_p;
+  bucketSize = t_bucketSize > 0 ? t_bucketSize : 1;
+  method = KDTreeSplitMethod::midpointSlide;
+
+  if (N == 0) {
+    throw std::range_error("(KDFlatTree) N must be > 0");
+    return;
+  }
+
+  ids.resize(N);
+  levels.resize(N);
+  coordinates.resize(N * p);
+  nodes.reserve(4 * (N / bucketSize) + 1);
+
+  for (size_t i = 0; i < N; i++)
+    ids[i] = i;
+}
+
+KDFlatTree::~KDFlatTree() {}
+
+// Builds the node of the units at positions [start, end) of ids, and its
+// subtree, in depth first order, appending the nodes to out. The indices of the
+// nodes are relative to the start of out. The cell of the node is found in the
+// scratch buffer, and is restored before returning.
+// If the node has more than taskThreshold units, its children are built as
+// separate tasks, each with its own nodes and scratch buffer, and appended in
+// order, so that the nodes are the same as if built serially.
+size_t KDFlatTree::BuildNode(
+  std::vector<KDFlatNode>& out,
+  const double* data,
+  const size_t start,
+  const size_t end,
+  const size_t depth,
+  double* scratch,
+  const size_t taskThreshold
+) {
+  size_t index = out.size();
+  out.emplace_back();
+  KDFlatNode& node = out[index];
+  node.value = 0.0;
+  node.split = KDFlatNode::terminal;
+  node.right = 0;
+  node.start = start;
+  node.end = end;
+  node.minLevel = SIZE_MAX;
+
+  size_t n = end - start;
+  if (n <= bucketSize)
+    return index;
+
+  // m should be the number of units in the left child, i.e. left = [0, m),
+  // right = [m, n)
+  size_t m;
+  switch (method) {
+  case KDTreeSplitMethod::variable:
+    m = SplitByVariable(node, data, start, end, depth);
+    break;
+  case KDTreeSplitMethod::maximalSpread:
+    m = SplitByMaximalSpread(node, data, start, end, scratch);
+    break;
+  default:
+    m = SplitByMidpointSlide(node, data, start, end, scratch);
+    break;
+  }
+
+  // If m is 0 or n, we need to accept all units into the node
+  if (m == 0 || m >= n) {
+    node.split = KDFlatNode::terminal;
+    node.value = 0.0;
+    return index;
+  }
+
+  size_t split = node.split;
+  double value = node.value;
+
+  if (n > taskThreshold) {
+    std::vector<KDFlatNode> leftNodes;
+    std::vector<KDFlatNode> rightNodes;
+    std::vector<double> leftScratch(scratch, scratch + 4 * p);
+    std::vector<double> rightScratch(scratch, scratch + 4 * p);
+    leftScratch[p + split] = std::min(leftScratch[p + split], value);
+    rightScratch[split] = std::max(rightScratch[split], value);
+
+    #ifdef _OPENMP
+    #pragma omp task shared(leftNodes, leftScratch)
+    #endif
+    BuildNode(leftNodes, data, start, start + m, depth + 1, leftScratch.data(), taskThreshold);
+
+    #ifdef _OPENMP
+    #pragma omp task shared(rightNodes, rightScratch)
+    #endif
+    BuildNode(rightNodes, data, start + m, end, depth + 1, rightScratch.data(), taskThreshold);
+
+    #ifdef _OPENMP
+    #pragma omp taskwait
+    #endif
+
+    AppendNodes(out, leftNodes);
+    size_t right = out.size();
+    AppendNodes(out, rightNodes);
+
+    out[index].split = split;
+    out[index].value = value;
+    out[index].right = right;
+    return index;
+  }
+
+  double previous = scratch[p + split];
+  scratch[p + split] = std::min(previous, value);
+  BuildNode(out, data, start, start + m, depth + 1, scratch, taskThreshold);
+  scratch[p + split] = previous;
+
+  previous = scratch[split];
+  scratch[split] = std::max(previous, value);
+  size_t right = BuildNode(out, data, start + m, end, depth + 1, scratch, taskThreshold);
+  scratch[split] = previous;
+
+  out[index].right = right;
+  return index;
+}
+
+// Appends the nodes of a subtree, shifting the indices of the right children
+void KDFlatTree::AppendNodes(std::vector<KDFlatNode>& out, const std::vector<KDFlatNode>& subtree) {
+  size_t offset = out.size();
+
+  for (size_t i = 0; i < subtree.size(); i++) {
+    out.push_back(subtree[i]);
+
+    if (subtree[i].split != KDFlatNode::terminal)
+      out.back().right += offset;
+  }
+
+  return;
+}
+
+size_t KDFlatTree::SplitByVariable(
+  KDFlatNode& node,
+  const double* data,
+  const size_t start,
+  const size_t end,
+  const size_t depth
+) {
+  node.split = depth % p;
+  return SplitAtMedian(node, data, start, end);
+}
+
+size_t KDFlatTree::SplitByMaximalSpread(
+  KDFlatNode& node,
+  const double* data,
+  const size_t start,
+  const size_t end,
+  double* scratch
+) {
+  double* mins = scratch + 2 * p;
+  double* maxs = mins + p;
+
+  const double* dt = data + ids[start] * p;
+  for (size_t k = 0; k < p; k++) {
+    mins[k] = dt[k];
+    maxs[k] = dt[k];
+  }
+
+  for (size_t i = start + 1; i < end; i++) {
+    dt = data + ids[i] * p;
+    for (size_t k = 0; k < p; k++) {
+      if (dt[k] < mins[k])
+        mins[k] = dt[k];
+      else if (dt[k] > maxs[k])
+        maxs[k] = dt[k];
+    }
+  }
+
+  // Decide the splitting variable by finding the variable with the largest spread
+  size_t split = 0;
+  double spread = maxs[0] - mins[0];
+  for (size_t k = 1; k < p; k++) {
+    double temp = maxs[k] - mins[k];
+    if (temp > spread) {
+      split = k;
+      spread = temp;
+    }
+  }
+
+  // If there is no spread in any variable, we shouldn't split more
+  if (spread == 0.0)
+    return 0;
+
+  node.split = split;
+  return SplitAtMedian(node, data, start, end);
+}
+
+// Splits the units at the median of the split variable of the node, selected
+// in place. All units equal to the median are put in the left child, and the
+// median becomes the split value.
+size_t KDFlatTree::SplitAtMedian(
+  KDFlatNode& node,
+  const double* data,
+  const size_t start,
+  const size_t end
+) {
+  size_t split = node.split;
+  size_t* units = ids.data() + start;
+  size_t n = end - start;
+  size_t mid = n >> 1;
+
+  std::nth_element(
+    units,
+    units + mid,
+    units + n,
+    [data, split, this](size_t a, size_t b) { return data[a * p + split] < data[b * p + split]; }
+  );
+
+  double value = data[units[mid] * p + split];
+  size_t* last = std::partition(
+    units + mid + 1,
+    units + n,
+    [data, split, value, this](size_t a) { return data[a * p + split] <= value; }
+  );
+
+  node.value = value;
+  return (size_t)(last - units);
+}
+
+// Splits the cell of the node, from the scratch buffer, at the midpoint of its
+// widest side. If all units fall on one side of the midpoint, the split slides
+// to the nearest unit.
+size_t KDFlatTree::SplitByMidpointSlide(
+  KDFlatNode& node,
+  const double* data,
+  const size_t start,
+  const size_t end,
+  const double* scratch
+) {
+  const double* mins = scratch;
+  const double* maxs = mins + p;
+
+  // Decide the splitting variable by finding the variable with the largest window
+  size_t split = 0;
+  double spread = maxs[0] - mins[0];
+  for (size_t k = 1; k < p; k++) {
+    double temp = maxs[k] - mins[k];
+    if (temp > spread) {
+      split = k;
+      spread = temp;
+    }
+  }
+
+  // If there is no spread in any variable, we shouldn't split more
+  if (spread == 0.0)
+    return 0;
+
+  // Decide a candidate splitting value
+  double value = (maxs[split] + mins[split]) * 0.5;
+  node.split = split;
+  node.value = value;
+
+  size_t* splitUnits = ids.data() + start;
+  size_t n = end - start;
+  const double* dt = data + split;
+  size_t l = 0;
+  size_t r = n;
+  double lbig = -DBL_MAX;
+  double rsmall = DBL_MAX;
+
+  // Sort splitUnits so that we have
+  // x <= value is in range [0, l)
+  // x > value is in range [r, n)
+  while (l < r) {
+    double temp = *(dt + splitUnits[l] * p);
+    if (temp <= value) {
+      l += 1;
+
+      if (temp > lbig) {
+        lbig = temp;
+        // If we know there are small units, we don't need to track the big
+        rsmall = -DBL_MAX;
+      }
+    } else {
+      r -= 1;
+      std::swap(splitUnits[l], splitUnits[r]);
+
+      if (temp < rsmall) {
+        rsmall = temp;
+        // If we know there are big units, we don't need to track the small
+        lbig = DBL_MAX;
+      }
+    }
+  }
+
+  // If there exists units on both sides of the splitting value
+  // we can be satisfied with the proposed split
+  if (l > 0 && r < n)
+    return l;
+
+  // All units are > than the proposed splitting value: move the split to the
+  // smallest units
+  if (l == 0) {
+    for (size_t i = 0; i < n; i++) {
+      double temp = *(dt + splitUnits[i] * p);
+      if (temp == rsmall) {
+        if (i != l)
+          std::swap(splitUnits[i], splitUnits[l]);
+
+        l += 1;
+      }
+    }
+
+    if (l == n)
+      return 0;
+
+    node.value = rsmall;
+    return l;
+  }
+
+  // All units are <= than the proposed splitting value: move the biggest
+  // units to the right, and the split to the next biggest value
+  if (r == n) {
+    rsmall = -DBL_MAX;
+
+    for (size_t i = n; i-- > 0;) {
+      double temp = *(dt + splitUnits[i] * p);
+      if (temp == lbig) {
+        r -= 1;
+
+        if (i != r)
+          std::swap(splitUnits[i], splitUnits[r]);
+      } else {
+        if (temp > rsmall)
+          rsmall = temp;
+      }
+    }
+
+    if (r == 0)
+      return 0;
+
+    node.value = rsmall;
+    return r;
+  }
+
+  throw std::runtime_error("(SplitByMidpointSlide) something went wrong in splitting");
+  return 0;
+}
+
+// Copies the units of the leaves into place, see KDLeafIndex::CopyLeaf, using
+// nThreads threads, and lists the leaves
+void KDFlatTree::SetLeaves(const double* data, const size_t* t_levels, const size_t nThreads) {
+  #ifndef _OPENMP
+  (void)nThreads;
+  #endif
+
+  #ifdef _OPENMP
+  #pragma omp parallel for num_threads(nThreads) schedule(dynamic, 64)
+  #endif
+  for (size_t index = 0; index < nodes.size(); index++) {
+    KDFlatNode& node = nodes[index];
+    if (node.split == KDFlatNode::terminal)
+      node.minLevel = CopyLeaf(node.start, node.end, data, t_levels);
+  }
+
+  leaves.resize(0);
+  for (size_t index = 0; index < nodes.size(); index++) {
+    const KDFlatNode& node = nodes[index];
+    if (node.split == KDFlatNode::terminal)
+      leaves.push_back(KDLeaf{node.start, node.end, node.minLevel});
+  }
+
+  return;
+}
+
+// Sets the bounding boxes and smallest levels of all nodes. The children of a
+// node follow the node, so the nodes are visited in reverse order.
+void KDFlatTree::SetBoxes() {
+  boxes.resize(nodes.size() * 2 * p);
+
+  for (size_t index = nodes.size(); index-- > 0;) {
+    KDFlatNode& node = nodes[index];
+    double* box = boxes.data() + index * 2 * p;
+
+    if (node.split == KDFlatNode::terminal) {
+      SetLeafBox(node.start, node.end, box);
+      continue;
+    }
+
+    const double* lbox = boxes.data() + (index + 1) * 2 * p;
+    const double* rbox = boxes.data() + node.right * 2 * p;
+    for (size_t k = 0; k < p; k++) {
+      box[k] = std::min(lbox[k], rbox[k]);
+      box[p + k] = std::max(lbox[p + k], rbox[p + k]);
+    }
+
+    node.minLevel = std::min(nodes[index + 1].minLevel, nodes[node.right].minLevel);
+  }
+
+  return;
+}
+
+// Chooses the bucket size and/or the split method of a tree, by timing the
+// build and a sample of maxSize neighbour searches for each candidate setting.
+// The setting with the smallest build time plus the search time scaled to all N
+// units is kept. The choice does not affect the neighbours found by exact
+// searches, only the time to find them. As it depends on the timing, it is not
+// to be used for approximate searches, see KDLeafIndex::SetApproximation.
+void KDFlatTree::Calibrate(
+  double* t_dt,
+  const size_t t_N,
+  const size_t t_p,
+  const size_t maxSize,
+  size_t* bucketSize,
+  KDTreeSplitMethod* method,
+  const bool calibrateBucketSize,
+  const bool calibrateMethod
+) {
+  const size_t maxSample = 256;
+
+  std::vector<size_t> bucketSizes = {*bucketSize};
+  if (calibrateBucketSize)
+    bucketSizes = {4, 8, 16, 32, 64, 128};
+
+  std::vector<KDTreeSplitMethod> methods = {*method};
+  if (calibrateMethod) {
+    methods = {
+      KDTreeSplitMethod::midpointSlide,
+      KDTreeSplitMethod::maximalSpread,
+      KDTreeSplitMethod::variable
+    };
+  }
+
+  if (t_N == 0 || (bucketSizes.size() == 1 && methods.size() == 1))
+    return;
+
+  size_t nSample = std::min(t_N, maxSample);
+  KDHeapStore store(maxSize);
+  KDFlatStack stack;
+  double bestCost = DBL_MAX;
+
+  for (size_t b = 0; b < bucketSizes.size(); b++) {
+    for (size_t m = 0; m < methods.size(); m++) {
+      std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+      KDFlatTree tree(t_dt, t_N, t_p, bucketSizes[b], methods[m], nullptr, 1);
+      std::chrono::steady_clock::time_point built = std::chrono::steady_clock::now();
+
+      for (size_t i = 0; i < nSample; i++) {
+        store.Reset();
+        tree.SearchLeavesForNeighbours(&tree, &store, t_dt + (i * t_N / nSample) * t_p, SIZE_MAX, &stack, nullptr);
+      }
+
+      std::chrono::steady_clock::time_point searched = std::chrono::steady_clock::now();
+      double cost = std::chrono::duration<double>(built - start).count() +
+        std::chrono::duration<double>(searched - built).count() * (double)t_N / (double)nSample;
+
+      if (cost < bestCost) {
+        bestCost = cost;
+        *bucketSize = bucketSizes[b];
+        *method = methods[m];
+      }
+    }
+  }
+
+  return;
+}
+
+// Finds the neighbours of unit among the units with a level of at most
+// maxLevel. The neighbours are left in the heap of the store, see
+// KDHeapStore::SortNeighbours
+void KDFlatTree::FindNeighbours(KDHeapStore* store, const double* unit, const size_t maxLevel) {
+  store->Reset();
+
+  if (nodes.size() == 0) {
+    throw std::runtime_error("(FindNeighbours) tree is empty");
+    return;
+  }
+
+  KDFlatStack stack;
+  SearchLeavesForNeighbours(this, store, unit, maxLevel, &stack, nullptr);
+  return;
+}
+
+// Finds the neighbours of all units with a level of at most maxLevel, see
+// KDLeafIndex::FindAllNeighboursByLeaf
+void KDFlatTree::FindAllNeighbours(
+  KDNeighbours* result,
+  const size_t maxSize,
+  const size_t maxLevel,
+  const size_t nThreads
+) {
+  if (nodes.size() == 0) {
+    throw std::runtime_error("(FindAllNeighbours) tree is empty");
+    return;
+  }
+
+  FindAllNeighboursByLeaf(this, result, maxSize, maxLevel, nThreads);
+  return;
+}
+
+// Starts a search at the root, whose cell is the bounding box of all units
+void KDFlatTree::StartSearch(const double* unit, KDFlatStack* stack) {
+  stack->nodes.resize(0);
+  stack->distances.resize(0);
+  stack->offsets.resize(0);
+
+  stack->nodes.push_back(0);
+  stack->distances.push_back(0.0);
+  for (size_t k = 0; k < p; k++) {
+    const double* box = boxes.data();
+    double temp = 0.0;
+    if (unit[k] < box[k])
+      temp = box[k] - unit[k];
+    else if (unit[k] > box[p + k])
+      temp = unit[k] - box[p + k];
+
+    stack->offsets.push_back(temp);
+    stack->distances[0] += temp * temp;
+  }
+
+  stack->current.resize(p);
+  return;
+}
+
+// Finds the next leaf of a search, traversing the tree depth first, nearest
+// child first, from the explicit stack. The bound of the leaf is the distance
+// to its bounding box. The squared distance from the unit to the cell of each
+// node is updated incrementally: the far child of a node differs from the node
+// only in the split dimension, where the distance becomes the distance to the
+// split value. A node is skipped if its cell is farther away than the farthest
+// neighbour. As the incremental distances may be rounded up, the cells are only
+// skipped by a margin, while the bounding boxes are compared exactly, so that
+// no ties are lost. In approximate searches, the distances are scaled by
+// pruneFactor.
+bool KDFlatTree::NextLeaf(
+  KDHeapStore* store,
+  const double* unit,
+  const size_t maxLevel,
+  KDFlatStack* stack,
+  size_t* start,
+  size_t* end,
+  double* bound
+) {
+  std::vector<double>& offsets = stack->current;
+
+  while (stack->nodes.size() > 0) {
+    size_t index = stack->nodes.back();
+    double distance = stack->distances.back();
+    std::copy(stack->offsets.end() - p, stack->offsets.end(), offsets.begin());
+    stack->nodes.pop_back();
+    stack->distances.pop_back();
+    stack->offsets.resize(stack->offsets.size() - p);
+
+    while (true) {
+      // The cell is farther away than all neighbours
+      if (store->SizeFulfilled() && distance * pruneFactor > store->MaximumDistance() * (1.0 + 16.0 * DBL_EPSILON))
+        break;
+
+      const KDFlatNode& node = nodes[index];
+
+      // No unit of the node has a level of at most maxLevel
+      if (node.minLevel > maxLevel)
+        break;
+
+      stack->visitedNodes += 1;
+
+      if (node.split == KDFlatNode::terminal) {
+        *start = node.start;
+        *end = node.end;
+        *bound = BoxDistance(unit, boxes.data() + index * 2 * p);
+        return true;
+      }
+
+      double offset = unit[node.split] - node.value;
+      size_t nextNode = offset <= 0.0 ? index + 1 : node.right;
+      size_t otherNode = offset <= 0.0 ? node.right : index + 1;
+
+      // Push the far child, and continue with the near child
+      stack->nodes.push_back(otherNode);
+      stack->distances.push_back(
+        distance - offsets[node.split] * offsets[node.split] + offset * offset
+      );
+      stack->offsets.insert(stack->offsets.end(), offsets.begin(), offsets.end());
+      stack->offsets[stack->offsets.size() - p + node.split] = offset;
+
+      index = nextNode;
+    }
+  }
+
+  return false;
+}
@@ -0,0 +1,116 @@
+#ifndef KDFLATTREECLASS_HEADER
+#define KDFLATTREECLASS_HEADER
+
+#include <stddef.h>
+#include <vector>
+
+#include "KDHeapStoreClass.h"
+#include "KDLeafIndexClass.h"
+#include "KDNeighboursClass.h"
+#include "KDTreeSplitMethod.h"
+
+// A node of KDFlatTree. The left child of an inner node directly follows the
+// node, and the right child is found at index right. The units of the node are
+// the positions [start, end) of the permuted arrays of the tree.
+struct KDFlatNode {
+  double value; // Split value, read together with split in the traversal
+  size_t split; // Split dimension, or KDFlatNode::terminal
+  size_t right;
+  size_t start;
+  size_t end;
+  size_t minLevel; // The smallest level of the units of the node
+
+  static const size_t terminal = (size_t)-1;
+};
+
+// The explicit stack of the searches of KDFlatTree, its Cursor: the nodes left
+// to visit, with the squared distance from the unit to their cells, and the
+// distance from the unit to their cells per dimension (p per node), and the
+// offsets of the current node. Also counts the nodes and leaves visited by the
+// searches using the stack.
+struct KDFlatStack {
+  std::vector<size_t> nodes = std::vector<size_t>(0);
+  std::vector<double> distances = std::vector<double>(0);
+  std::vector<double> offsets = std::vector<double>(0);
+  std::vector<double> current = std::vector<double>(0);
+  size_t visitedNodes = 0;
+  size_t visitedLeaves = 0;
+};
+
+// A KD-tree stored without pointers: the nodes are kept in one array, in depth
+// first order, and the units are stored by leaf, see KDLeafIndex. Each node
+// also keeps the bounding box of its units, i.e. the smallest box containing
+// them. The tree is immutable once built.
+// The tree is built without allocating per node: the ids are split in place,
+// with in place median selection, and the cell of the current node and the
+// spreads of its units are kept in one scratch buffer (per task, if built in
+// parallel). The arrays of the tree are sized up front.
+class KDFlatTree : public KDLeafIndex {
+  friend class KDLeafIndex;
+
+protected:
+  size_t bucketSize;
+  KDTreeSplitMethod method;
+
+public:
+  typedef KDFlatStack Cursor;
+
+  std::vector<KDFlatNode> nodes = std::vector<KDFlatNode>(0);
+  std::vector<double> boxes = std::vector<double>(0); // Per node, p minimums, then p maximums
+
+public:
+  KDFlatTree(
+    double*,
+    const size_t,
+    const size_t,
+    const size_t,
+    const KDTreeSplitMethod,
+    const size_t*,
+    const size_t
+  );
+  ~KDFlatTree();
+
+protected:
+  KDFlatTree(const size_t, const size_t, const size_t);
+
+public:
+  static void Calibrate(
+    double*,
+    const size_t,
+    const size_t,
+    const size_t,
+    size_t*,
+    KDTreeSplitMethod*,
+    const bool,
+    const bool
+  );
+
+private:
+  size_t BuildNode(
+    std::vector<KDFlatNode>&,
+    const double*,
+    const size_t,
+    const size_t,
+    const size_t,
+    double*,
+    const size_t
+  );
+  void AppendNodes(std::vector<KDFlatNode>&, const std::vector<KDFlatNode>&);
+  size_t SplitByVariable(KDFlatNode&, const double*, const size_t, const size_t, const size_t);
+  size_t SplitByMaximalSpread(KDFlatNode&, const double*, const size_t, const size_t, double*);
+  size_t SplitByMidpointSlide(KDFlatNode&, const double*, const size_t, const size_t, const double*);
+  size_t SplitAtMedian(KDFlatNode&, const double*, const size_t, const size_t);
+
+protected:
+  void SetLeaves(const double*, const size_t*, const size_t);
+  void SetBoxes();
+
+public:
+  void FindNeighbours(KDHeapStore*, const double*, const size_t);
+  void FindAllNeighbours(KDNeighbours*, const size_t, const size_t, const size_t);
+private:
+  void StartSearch(const double*, KDFlatStack*);
+  bool NextLeaf(KDHeapStore*, const double*, const size_t, KDFlatStack*, size_t*, size_t*, double*);
+};
+
+#endif
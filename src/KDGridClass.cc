@@ -0,0 +1,313 @@
+#include <algorithm>
+#include <cmath>
+#include <float.h>
+#include <stddef.h>
+#include <stdexcept>
+#include <stdint.h>
+#include <utility>
+#include <vector>
+
+#include "KDGridClass.h"
+#include "KDHeapStoreClass.h"
+#include "KDLeafIndexClass.h"
+#include "KDNeighboursClass.h"
+
+const size_t KDGrid::maxDimensions;
+
+// Builds the grid over the N units of t_dt, stored unit major. The levels are
+// optional, see KDFlatTree::KDFlatTree.
+KDGrid::KDGrid(
+  const double* t_dt,
+  const size_t t_N,
+  const size_t t_p,
+  const size_t t_meanSize,
+  const size_t* t_levels
+) {
+  N = t_N;
+  p = t_p;
+  meanSize = t_meanSize > 0 ? t_meanSize : 1;
+
+  if (N == 0) {
+    throw std::range_error("(KDGrid) N must be > 0");
+    return;
+  }
+
+  if (p == 0 || p > maxDimensions) {
+    throw std::range_error("(KDGrid) p must be 1, 2 or 3");
+    return;
+  }
+
+  // The bounding box of all units
+  double extents[3] = {0.0, 0.0, 0.0};
+  double maxAbs = 0.0;
+  for (size_t k = 0; k < p; k++) {
+    double lo = DBL_MAX;
+    double hi = -DBL_MAX;
+    for (size_t i = 0; i < N; i++) {
+      double value = t_dt[i * p + k];
+      if (value < lo)
+        lo = value;
+      if (value > hi)
+        hi = value;
+    }
+
+    origin[k] = lo;
+    extents[k] = hi - lo;
+    maxAbs = std::max(maxAbs, std::max(std::fabs(lo), std::fabs(hi)));
+  }
+
+  // The side of the cells, such that the cells of the box hold meanSize units
+  // on average. Dimensions without extent have one cell. If the box is very
+  // flat, the cells are enlarged until there are at most 4N cells.
+  double volume = 1.0;
+  size_t nExtended = 0;
+  for (size_t k = 0; k < p; k++) {
+    if (extents[k] > 0.0) {
+      volume *= extents[k];
+      nExtended += 1;
+    }
+  }
+
+  side = nExtended > 0 ? std::pow(volume * (double)meanSize / (double)N, 1.0 / (double)nExtended) : 1.0;
+  if (!(side > 0.0))
+    side = DBL_MIN;
+
+  while (true) {
+    double nCells = 1.0;
+    for (size_t k = 0; k < p; k++)
+      nCells *= std::floor(extents[k] / side) + 1.0;
+
+    if (nCells <= 4.0 * (double)N + 16.0)
+      break;
+
+    side *= 2.0;
+  }
+
+  size_t nCells = 1;
+  for (size_t k = 0; k < p; k++) {
+    dims[k] = (size_t)(extents[k] / side) + 1;
+    nCells *= dims[k];
+  }
+
+  // The cell of a unit is computed with rounding, thus a unit may be a few
+  // ulps outside of its cell
+  slack = 8.0 * DBL_EPSILON * (maxAbs + side * (double)(*std::max_element(dims, dims + 3)));
+
+  // Sort the units by cell, by counting
+  std::vector<size_t> cells(N);
+  offsets.assign(nCells + 1, 0);
+  for (size_t i = 0; i < N; i++) {
+    size_t cell = 0;
+    for (size_t k = p; k --> 0;)
+      cell = cell * dims[k] + CellIndex(t_dt[i * p + k], k);
+
+    cells[i] = cell;
+    offsets[cell + 1] += 1;
+  }
+
+  for (size_t cell = 0; cell < nCells; cell++)
+    offsets[cell + 1] += offsets[cell];
+
+  std::vector<size_t> positions(offsets.begin(), offsets.end() - 1);
+  ids.resize(N);
+  levels.resize(N);
+  coordinates.resize(N * p);
+
+  for (size_t i = 0; i < N; i++)
+    ids[positions[cells[i]]++] = i;
+
+  // The non-empty cells are the leaves
+  minLevels.assign(nCells, SIZE_MAX);
+  boxes.resize(nCells * 2 * p);
+
+  for (size_t cell = 0; cell < nCells; cell++) {
+    if (offsets[cell] == offsets[cell + 1])
+      continue;
+
+    minLevels[cell] = CopyLeaf(offsets[cell], offsets[cell + 1], t_dt, t_levels);
+    SetLeafBox(offsets[cell], offsets[cell + 1], boxes.data() + cell * 2 * p);
+    leaves.push_back(KDLeaf{offsets[cell], offsets[cell + 1], minLevels[cell]});
+  }
+}
+
+KDGrid::~KDGrid() {}
+
+size_t KDGrid::GetCells() {
+  return offsets.size() - 1;
+}
+
+// The mean, over the units, of the number of units of the cell of the unit.
+// It is close to meanSize if the units are evenly spread, and much larger if
+// they are clustered, in which case a tree is to be preferred.
+double KDGrid::MeanOccupancy() {
+  double sum = 0.0;
+  for (size_t cell = 0; cell < GetCells(); cell++) {
+    double count = (double)(offsets[cell + 1] - offsets[cell]);
+    sum += count * count;
+  }
+
+  return sum / (double)N;
+}
+
+// The index of the cell of value in dimension k. Values outside of the grid
+// belong to the nearest cell.
+size_t KDGrid::CellIndex(const double value, const size_t k) {
+  double index = std::floor((value - origin[k]) / side);
+
+  if (!(index > 0.0))
+    return 0;
+  if (index >= (double)(dims[k] - 1))
+    return dims[k] - 1;
+
+  return (size_t)index;
+}
+
+// Finds the neighbours of unit among the units with a level of at most
+// maxLevel. The neighbours are left in the heap of the store, see
+// KDHeapStore::SortNeighbours
+void KDGrid::FindNeighbours(KDHeapStore* store, const double* unit, const size_t maxLevel) {
+  store->Reset();
+
+  KDGridCursor cursor;
+  SearchLeavesForNeighbours(this, store, unit, maxLevel, &cursor, nullptr);
+  return;
+}
+
+// Finds the neighbours of all units with a level of at most maxLevel, see
+// KDLeafIndex::FindAllNeighboursByLeaf. The visited and scanned cells are
+// summed in result, as nodes and leaves.
+void KDGrid::FindAllNeighbours(
+  KDNeighbours* result,
+  const size_t maxSize,
+  const size_t maxLevel,
+  const size_t nThreads
+) {
+  FindAllNeighboursByLeaf(this, result, maxSize, maxLevel, nThreads);
+  return;
+}
+
+// Finds the cells of ring r around the cell center, i.e. the cells of the grid
+// whose indices differ from those of center by exactly r in at least one
+// dimension, and by at most r in all dimensions
+void KDGrid::FindRing(std::vector<size_t>* ring, const size_t* center, const size_t r) {
+  size_t lo[3];
+  size_t hi[3];
+  for (size_t k = 0; k < maxDimensions; k++) {
+    lo[k] = center[k] >= r ? center[k] - r : 0;
+    hi[k] = std::min(center[k] + r, dims[k] - 1);
+  }
+
+  ring->resize(0);
+
+  for (size_t j2 = lo[2]; j2 <= hi[2]; j2++) {
+    for (size_t j1 = lo[1]; j1 <= hi[1]; j1++) {
+      size_t base = (j2 * dims[1] + j1) * dims[0];
+      bool onFace = r == 0
+        || j1 + r == center[1] || j1 == center[1] + r
+        || j2 + r == center[2] || j2 == center[2] + r;
+
+      if (onFace) {
+        for (size_t j0 = lo[0]; j0 <= hi[0]; j0++)
+          ring->push_back(base + j0);
+      } else {
+        // Only the ends of the row are in the ring
+        if (center[0] >= r)
+          ring->push_back(base + center[0] - r);
+        if (center[0] + r < dims[0])
+          ring->push_back(base + center[0] + r);
+      }
+    }
+  }
+
+  return;
+}
+
+// Starts a search at the cell of the unit
+void KDGrid::StartSearch(const double* unit, KDGridCursor* cursor) {
+  cursor->maxRing = 0;
+  for (size_t k = 0; k < p; k++) {
+    cursor->center[k] = CellIndex(unit[k], k);
+    cursor->maxRing = std::max(cursor->maxRing, std::max(cursor->center[k], dims[k] - 1 - cursor->center[k]));
+  }
+
+  cursor->nextRing = 0;
+  cursor->order.resize(0);
+  cursor->position = 0;
+  return;
+}
+
+// Finds the next cell of a search, searching the rings of cells around the cell
+// of the unit, nearest ring first, and the cells of a ring nearest first. The
+// bound of a cell is the distance to its bounding box. The search stops when
+// the cells outside of the searched rings are farther away than the farthest
+// neighbour, and the rest of a ring is skipped once a cell of the ring is. The
+// distances to the rings are computed from the edges of the cells, less a
+// margin for the rounding of the cells of the units, while the bounding boxes
+// are compared exactly, so that no ties are lost. In approximate searches, the
+// distances are scaled by pruneFactor.
+bool KDGrid::NextLeaf(
+  KDHeapStore* store,
+  const double* unit,
+  const size_t maxLevel,
+  KDGridCursor* cursor,
+  size_t* start,
+  size_t* end,
+  double* bound
+) {
+  const size_t* center = cursor->center;
+
+  while (true) {
+    if (cursor->position < cursor->order.size()) {
+      double distance = cursor->order[cursor->position].first;
+      size_t cell = cursor->order[cursor->position].second;
+      cursor->position += 1;
+      cursor->visitedNodes += 1;
+
+      // The cells left in the ring are farther away than all neighbours
+      if (store->SizeFulfilled() && distance * pruneFactor > store->MaximumDistance()) {
+        cursor->position = cursor->order.size();
+        continue;
+      }
+
+      *start = offsets[cell];
+      *end = offsets[cell + 1];
+      *bound = distance;
+      return true;
+    }
+
+    size_t r = cursor->nextRing;
+    if (r > cursor->maxRing)
+      return false;
+
+    if (r > 0 && store->SizeFulfilled()) {
+      // The distance from the unit to the cells outside of ring r - 1
+      double edge = DBL_MAX;
+      for (size_t k = 0; k < p; k++) {
+        if (center[k] >= r)
+          edge = std::min(edge, unit[k] - (origin[k] + (double)(center[k] - r + 1) * side));
+        if (center[k] + r < dims[k])
+          edge = std::min(edge, origin[k] + (double)(center[k] + r) * side - unit[k]);
+      }
+
+      edge = std::max(edge - slack, 0.0);
+      if (edge * edge * pruneFactor > store->MaximumDistance())
+        return false;
+    }
+
+    FindRing(&cursor->ring, center, r);
+
+    // The cells of the ring with units of at most maxLevel, nearest first
+    cursor->order.resize(0);
+    for (size_t c = 0; c < cursor->ring.size(); c++) {
+      size_t cell = cursor->ring[c];
+      if (offsets[cell] == offsets[cell + 1] || minLevels[cell] > maxLevel)
+        continue;
+
+      cursor->order.push_back(std::make_pair(BoxDistance(unit, boxes.data() + cell * 2 * p), cell));
+    }
+
+    std::sort(cursor->order.begin(), cursor->order.end());
+    cursor->position = 0;
+    cursor->nextRing = r + 1;
+  }
+}
@@ -0,0 +1,74 @@
+#ifndef KDGRIDCLASS_HEADER
+#define KDGRIDCLASS_HEADER
+
+#include <stddef.h>
+#include <utility>
+#include <vector>
+
+#include "KDHeapStoreClass.h"
+#include "KDLeafIndexClass.h"
+#include "KDNeighboursClass.h"
+
+// The state of a search of KDGrid, its Cursor: the cell of the unit, the cells
+// of the current ring with units of the searched levels, nearest first, with
+// the squared distances from the unit to their bounding boxes, and the next
+// ring. Also counts the cells visited and scanned by the searches using the
+// cursor, as nodes and leaves.
+struct KDGridCursor {
+  size_t center[3] = {0, 0, 0};
+  size_t maxRing = 0;
+  size_t nextRing = 0;
+  std::vector<size_t> ring = std::vector<size_t>(0);
+  std::vector<std::pair<double, size_t>> order = std::vector<std::pair<double, size_t>>(0);
+  size_t position = 0; // The next cell of order
+  size_t visitedNodes = 0;
+  size_t visitedLeaves = 0;
+};
+
+// A uniform grid (cell list) over units of at most 3 dimensions, searched in
+// rings of cells around the cell of the unit. It replaces KDFlatTree when the
+// units are few dimensional and fairly evenly spread, e.g. coordinates, as the
+// cell of a unit is found directly, and the nearest cells are found without
+// traversing a tree.
+// The cells are square, and sized so that a cell holds meanSize units on
+// average. The units are sorted by cell, and stored with the non-empty cells as
+// leaves, see KDLeafIndex. Each cell also keeps the bounding box of its units.
+// The grid is immutable once built.
+class KDGrid : public KDLeafIndex {
+  friend class KDLeafIndex;
+
+protected:
+  size_t meanSize;
+  double side; // The side of a cell
+  double slack; // Margin of the ring distances, for the rounding of the cells
+  size_t dims[3] = {1, 1, 1}; // The number of cells per dimension
+  double origin[3] = {0.0, 0.0, 0.0};
+
+public:
+  static const size_t maxDimensions = 3;
+  typedef KDGridCursor Cursor;
+
+  std::vector<size_t> offsets = std::vector<size_t>(0); // Per cell, plus one
+  std::vector<size_t> minLevels = std::vector<size_t>(0); // Per cell
+  std::vector<double> boxes = std::vector<double>(0); // Per cell, p minimums, then p maximums
+
+public:
+  KDGrid(const double*, const size_t, const size_t, const size_t, const size_t*);
+  ~KDGrid();
+
+  size_t GetCells();
+  double MeanOccupancy();
+
+private:
+  size_t CellIndex(const double, const size_t);
+
+public:
+  void FindNeighbours(KDHeapStore*, const double*, const size_t);
+  void FindAllNeighbours(KDNeighbours*, const size_t, const size_t, const size_t);
+private:
+  void FindRing(std::vector<size_t>*, const size_t*, const size_t);
+  void StartSearch(const double*, KDGridCursor*);
+  bool NextLeaf(KDHeapStore*, const double*, const size_t, KDGridCursor*, size_t*, size_t*, double*);
+};
+
+#endif
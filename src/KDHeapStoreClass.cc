@@ -0,0 +1,94 @@
+#include <algorithm>
+#include <float.h>
+#include <stddef.h>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+#include "KDHeapStoreClass.h"
+
+KDHeapStore::KDHeapStore(const size_t t_maxSize) {
+  Set(t_maxSize);
+}
+
+KDHeapStore::~KDHeapStore() {}
+
+void KDHeapStore::Set(const size_t t_maxSize) {
+  if (t_maxSize == 0) {
+    throw std::range_error("(Set) size must be > 0");
+    return;
+  }
+
+  maxSize = t_maxSize;
+  heap.reserve(maxSize);
+  neighbours.reserve(maxSize);
+
+  Reset();
+  return;
+}
+
+void KDHeapStore::Reset() {
+  heap.resize(0);
+  ties.resize(0);
+  return;
+}
+
+size_t KDHeapStore::GetSize() {
+  return heap.size() + ties.size();
+}
+
+bool KDHeapStore::SizeFulfilled() {
+  return heap.size() >= maxSize;
+}
+
+// The distance of the farthest unit kept
+double KDHeapStore::MaximumDistance() {
+  if (heap.size() == 0)
+    return DBL_MAX;
+
+  return heap.front().first;
+}
+
+void KDHeapStore::AddUnit(const size_t id, const double distance) {
+  if (heap.size() < maxSize) {
+    heap.push_back(Neighbour(distance, id));
+    std::push_heap(heap.begin(), heap.end());
+    return;
+  }
+
+  double maximum = heap.front().first;
+
+  // Farther than all kept units
+  if (distance > maximum)
+    return;
+
+  // Tied with the farthest kept unit
+  if (distance == maximum) {
+    ties.push_back(Neighbour(distance, id));
+    return;
+  }
+
+  // Replace the farthest kept unit. If it is still tied with the new farthest
+  // unit, it is kept as a tie, otherwise all ties are dropped.
+  std::pop_heap(heap.begin(), heap.end());
+  Neighbour removed = heap.back();
+  heap.back() = Neighbour(distance, id);
+  std::push_heap(heap.begin(), heap.end());
+
+  if (heap.front().first == maximum) {
+    ties.push_back(removed);
+  } else {
+    ties.resize(0);
+  }
+
+  return;
+}
+
+// Collects the kept units and their ties into neighbours, ordered by distance,
+// and by id within equal distances
+void KDHeapStore::SortNeighbours() {
+  neighbours.assign(heap.begin(), heap.end());
+  neighbours.insert(neighbours.end(), ties.begin(), ties.end());
+  std::sort(neighbours.begin(), neighbours.end());
+  return;
+}
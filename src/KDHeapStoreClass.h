@@ -0,0 +1,34 @@
+#ifndef KDHEAPSTORECLASS_HEADER
+#define KDHEAPSTORECLASS_HEADER
+
+#include <stddef.h>
+#include <utility>
+#include <vector>
+
+// A neighbour store of bounded size: the maxSize nearest units are kept in a
+// max-heap of (distance, id), and the units tied with the farthest of these in
+// a separate list. Thus, the memory is O(maxSize + ties), independent of the
+// number of units, and adding a unit is O(log maxSize).
+class KDHeapStore {
+public:
+  typedef std::pair<double, size_t> Neighbour; // (distance, id)
+
+  size_t maxSize;
+  std::vector<Neighbour> heap = std::vector<Neighbour>(0);
+  std::vector<Neighbour> ties = std::vector<Neighbour>(0);
+  std::vector<Neighbour> neighbours = std::vector<Neighbour>(0); // See SortNeighbours
+
+  KDHeapStore(const size_t);
+  ~KDHeapStore();
+  void Set(const size_t);
+  void Reset();
+
+  size_t GetSize();
+  bool SizeFulfilled();
+  double MaximumDistance();
+
+  void AddUnit(const size_t, const double);
+  void SortNeighbours();
+};
+
+#endif
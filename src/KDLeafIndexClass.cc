@@ -0,0 +1,129 @@
+#include <algorithm>
+#include <float.h>
+#include <stddef.h>
+#include <stdexcept>
+#include <stdint.h>
+#include <vector>
+
+#include "KDHeapStoreClass.h"
+#include "KDLeafIndexClass.h"
+#include "utils-distance.h"
+
+size_t KDLeafIndex::GetSize() {
+  return N;
+}
+
+// Sets the searches to be approximate. A leaf or node is skipped if it is
+// farther away than the farthest neighbour divided by (1 + eps), so that each
+// neighbour found is at most (1 + eps) times as far away as the true neighbour
+// of the same rank. If maxLeaves > 0, a search stops once maxLeaves leaves have
+// been scanned and the store is full. eps = 0 and maxLeaves = 0 gives exact
+// searches.
+void KDLeafIndex::SetApproximation(const double eps, const size_t t_maxLeaves) {
+  if (eps < 0.0) {
+    throw std::range_error("(SetApproximation) eps must be >= 0");
+    return;
+  }
+
+  pruneFactor = (1.0 + eps) * (1.0 + eps);
+  maxLeaves = t_maxLeaves;
+  return;
+}
+
+// Copies the coordinates and levels of the units ids[start, end) of a leaf into
+// place, and returns the smallest level of the units. The levels are optional.
+size_t KDLeafIndex::CopyLeaf(
+  const size_t start,
+  const size_t end,
+  const double* data,
+  const size_t* t_levels
+) {
+  size_t leafSize = end - start;
+  double* leafCoordinates = coordinates.data() + start * p;
+  size_t minLevel = SIZE_MAX;
+
+  for (size_t i = start; i < end; i++) {
+    levels[i] = t_levels != nullptr ? t_levels[ids[i]] : 0;
+
+    if (levels[i] < minLevel)
+      minLevel = levels[i];
+  }
+
+  for (size_t k = 0; k < p; k++) {
+    for (size_t i = 0; i < leafSize; i++)
+      leafCoordinates[k * leafSize + i] = data[ids[start + i] * p + k];
+  }
+
+  return minLevel;
+}
+
+// Sets box to the bounding box of the units of a leaf, p minimums, then p
+// maximums
+void KDLeafIndex::SetLeafBox(const size_t start, const size_t end, double* box) {
+  size_t leafSize = end - start;
+  const double* leafCoordinates = coordinates.data() + start * p;
+
+  for (size_t k = 0; k < p; k++) {
+    box[k] = DBL_MAX;
+    box[p + k] = -DBL_MAX;
+
+    for (size_t i = 0; i < leafSize; i++) {
+      double value = leafCoordinates[k * leafSize + i];
+      if (value < box[k])
+        box[k] = value;
+      if (value > box[p + k])
+        box[p + k] = value;
+    }
+  }
+
+  return;
+}
+
+// The squared distance from the unit to a bounding box
+double KDLeafIndex::BoxDistance(const double* unit, const double* box) {
+  double distance = 0.0;
+
+  for (size_t k = 0; k < p; k++) {
+    double temp = 0.0;
+    if (unit[k] < box[k])
+      temp = box[k] - unit[k];
+    else if (unit[k] > box[p + k])
+      temp = unit[k] - box[p + k];
+
+    distance += temp * temp;
+  }
+
+  return distance;
+}
+
+// Adds the units of the leaf [start, end) to the store, computing their
+// distances in blocks
+void KDLeafIndex::SearchLeafForNeighbours(
+  KDHeapStore* store,
+  const double* unit,
+  const size_t maxLevel,
+  const size_t start,
+  const size_t end
+) {
+  const size_t blockSize = 64;
+  double distances[blockSize];
+  size_t leafSize = end - start;
+  const double* leafCoordinates = coordinates.data() + start * p;
+
+  for (size_t block = 0; block < leafSize; block += blockSize) {
+    size_t n = std::min(blockSize, leafSize - block);
+    BlockDistances(unit, leafCoordinates + block, leafSize, n, p, distances);
+
+    for (size_t j = 0; j < n; j++) {
+      size_t i = start + block + j;
+
+      // Skip if the unit is of a larger level
+      if (levels[i] > maxLevel)
+        continue;
+
+      store->AddUnit(ids[i], distances[j]);
+    }
+  }
+
+  return;
+}
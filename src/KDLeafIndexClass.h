@@ -0,0 +1,218 @@
+#ifndef KDLEAFINDEXCLASS_HEADER
+#define KDLEAFINDEXCLASS_HEADER
+
+#include <algorithm>
+#include <stddef.h>
+#include <vector>
+
+#include "KDHeapStoreClass.h"
+#include "KDNeighboursClass.h"
+
+// A leaf of KDLeafIndex: the units at the positions [start, end) of the arrays
+// of the index, and the smallest level of these units
+struct KDLeaf {
+  size_t start;
+  size_t end;
+  size_t minLevel;
+};
+
+// The units of a neighbour search index, stored by leaf (the leaves of a tree,
+// or the cells of a grid): the units are copied into leaf contiguous arrays of
+// coordinates, ids and levels. The coordinates of a leaf are stored dimension
+// major, i.e. coordinate k of position i of the leaf [start, end) is found at
+//   coordinates[start * p + k * (end - start) + (i - start)],
+// so that the distances to a block of units of the leaf can be computed at
+// once.
+// The neighbour searches are shared by the indices, which differ only in the
+// order in which they visit the leaves. An index, derived from KDLeafIndex,
+// supplies a Cursor, which holds the state of one search and counts its
+// visitedNodes and visitedLeaves, and the methods
+//   void StartSearch(const double* unit, Cursor*);
+//   bool NextLeaf(KDHeapStore*, const double* unit, const size_t maxLevel,
+//     Cursor*, size_t* start, size_t* end, double* bound);
+// where NextLeaf finds the next leaf to scan, nearest first, with a lower bound
+// of the squared distance from the unit to its units, or returns false if no
+// leaf is left. NextLeaf may skip the leaves and nodes that are farther away
+// than the farthest neighbour of the store.
+class KDLeafIndex {
+protected:
+  size_t N;
+  size_t p;
+  double pruneFactor = 1.0; // (1 + eps)^2, see SetApproximation
+  size_t maxLeaves = 0; // 0 for no limit
+
+public:
+  std::vector<KDLeaf> leaves = std::vector<KDLeaf>(0); // In order of position
+  std::vector<double> coordinates = std::vector<double>(0); // Per leaf, dimension major
+  std::vector<size_t> ids = std::vector<size_t>(0); // Per position
+  std::vector<size_t> levels = std::vector<size_t>(0); // Per position
+
+public:
+  size_t GetSize();
+  void SetApproximation(const double, const size_t);
+
+protected:
+  size_t CopyLeaf(const size_t, const size_t, const double*, const size_t*);
+  void SetLeafBox(const size_t, const size_t, double*);
+  double BoxDistance(const double*, const double*);
+  void SearchLeafForNeighbours(KDHeapStore*, const double*, const size_t, const size_t, const size_t);
+
+  template <class Index>
+  void SearchLeavesForNeighbours(Index*, KDHeapStore*, const double*, const size_t, typename Index::Cursor*, const KDLeaf*);
+  template <class Index>
+  void FindAllNeighboursByLeaf(Index*, KDNeighbours*, const size_t, const size_t, const size_t);
+};
+
+// Searches the leaves of the index, in the order given by NextLeaf, for the
+// neighbours of unit among the units with a level of at most maxLevel. A leaf
+// is skipped if its bound is farther away than the farthest neighbour. In
+// approximate searches, the bounds are scaled by pruneFactor, and the search
+// ends after maxLeaves scanned leaves, see SetApproximation.
+// The optional seed leaf is scanned first, and skipped by the traversal, so
+// that the store is already filled when the traversal starts pruning.
+template <class Index>
+void KDLeafIndex::SearchLeavesForNeighbours(
+  Index* index,
+  KDHeapStore* store,
+  const double* unit,
+  const size_t maxLevel,
+  typename Index::Cursor* cursor,
+  const KDLeaf* seed
+) {
+  size_t start;
+  size_t end;
+  double bound;
+  size_t scannedLeaves = 0;
+
+  index->StartSearch(unit, cursor);
+
+  if (seed != nullptr) {
+    SearchLeafForNeighbours(store, unit, maxLevel, seed->start, seed->end);
+    cursor->visitedLeaves += 1;
+    scannedLeaves += 1;
+  }
+
+  while (true) {
+    if (maxLeaves > 0 && scannedLeaves >= maxLeaves && store->SizeFulfilled())
+      break;
+
+    if (!index->NextLeaf(store, unit, maxLevel, cursor, &start, &end, &bound))
+      break;
+
+    // The seed leaf is already scanned
+    if (seed != nullptr && start == seed->start && end == seed->end)
+      continue;
+
+    // The leaf is farther away than all neighbours
+    if (store->SizeFulfilled() && bound * pruneFactor > store->MaximumDistance())
+      continue;
+
+    SearchLeafForNeighbours(store, unit, maxLevel, start, end);
+    cursor->visitedLeaves += 1;
+    scannedLeaves += 1;
+  }
+
+  return;
+}
+
+// Finds the maxSize nearest neighbours (with ties) of all units with a level of
+// at most maxLevel, among the units with a level of at most maxLevel. A unit is
+// its own nearest neighbour. The units are searched leaf by leaf, and the
+// leaves are distributed over nThreads threads. The searches of the units of a
+// leaf are independent traversals of the index, each seeded with the units of
+// the leaf itself, which are thus scanned while their coordinates are cached.
+// The result does not depend on the number of threads. The visited nodes and
+// leaves are summed in result.
+template <class Index>
+void KDLeafIndex::FindAllNeighboursByLeaf(
+  Index* index,
+  KDNeighbours* result,
+  const size_t maxSize,
+  const size_t maxLevel,
+  const size_t nThreads
+) {
+  #ifndef _OPENMP
+  (void)nThreads;
+  #endif
+
+  std::vector<size_t> searched;
+  for (size_t l = 0; l < leaves.size(); l++) {
+    if (leaves[l].minLevel <= maxLevel)
+      searched.push_back(l);
+  }
+
+  // The neighbours of each leaf, in the order of the units of the leaf
+  std::vector<std::vector<size_t>> leafIds(searched.size());
+  std::vector<std::vector<double>> leafDistances(searched.size());
+
+  result->Reset(N);
+  size_t visitedNodes = 0;
+  size_t visitedLeaves = 0;
+
+  #ifdef _OPENMP
+  #pragma omp parallel num_threads(nThreads) reduction(+:visitedNodes,visitedLeaves)
+  #endif
+  {
+    KDHeapStore store(maxSize);
+    typename Index::Cursor cursor;
+    std::vector<double> unit(p);
+
+    #ifdef _OPENMP
+    #pragma omp for schedule(dynamic, 1)
+    #endif
+    for (size_t l = 0; l < searched.size(); l++) {
+      const KDLeaf& leaf = leaves[searched[l]];
+      size_t leafSize = leaf.end - leaf.start;
+      const double* leafCoordinates = coordinates.data() + leaf.start * p;
+
+      for (size_t i = leaf.start; i < leaf.end; i++) {
+        if (levels[i] > maxLevel)
+          continue;
+
+        for (size_t k = 0; k < p; k++)
+          unit[k] = leafCoordinates[k * leafSize + (i - leaf.start)];
+
+        store.Reset();
+        SearchLeavesForNeighbours(index, &store, unit.data(), maxLevel, &cursor, &leaf);
+        store.SortNeighbours();
+
+        for (size_t j = 0; j < store.neighbours.size(); j++) {
+          leafIds[l].push_back(store.neighbours[j].second);
+          leafDistances[l].push_back(store.neighbours[j].first);
+        }
+
+        result->offsets[ids[i] + 1] = store.GetSize();
+      }
+    }
+
+    visitedNodes += cursor.visitedNodes;
+    visitedLeaves += cursor.visitedLeaves;
+  }
+
+  result->visitedNodes = visitedNodes;
+  result->visitedLeaves = visitedLeaves;
+
+  for (size_t id = 0; id < N; id++)
+    result->offsets[id + 1] += result->offsets[id];
+
+  result->ids.resize(result->offsets[N]);
+  result->distances.resize(result->offsets[N]);
+
+  for (size_t l = 0; l < searched.size(); l++) {
+    const KDLeaf& leaf = leaves[searched[l]];
+    size_t j = 0;
+
+    for (size_t i = leaf.start; i < leaf.end; i++) {
+      size_t id = ids[i];
+      size_t size = result->GetSize(id);
+
+      std::copy(leafIds[l].begin() + j, leafIds[l].begin() + j + size, result->ids.begin() + result->offsets[id]);
+      std::copy(leafDistances[l].begin() + j, leafDistances[l].begin() + j + size, result->distances.begin() + result->offsets[id]);
+      j += size;
+    }
+  }
+
+  return;
+}
+
+#endif
@@ -0,0 +1,29 @@
+#include <stddef.h>
+#include <vector>
+
+#include "KDNeighboursClass.h"
+
+KDNeighbours::KDNeighbours() {}
+KDNeighbours::~KDNeighbours() {}
+
+void KDNeighbours::Reset(const size_t t_N) {
+  N = t_N;
+  offsets.assign(N + 1, 0);
+  ids.resize(0);
+  distances.resize(0);
+  visitedNodes = 0;
+  visitedLeaves = 0;
+  return;
+}
+
+size_t KDNeighbours::GetSize(const size_t id) const {
+  return offsets[id + 1] - offsets[id];
+}
+
+const size_t* KDNeighbours::GetIds(const size_t id) const {
+  return ids.data() + offsets[id];
+}
+
+const double* KDNeighbours::GetDistances(const size_t id) const {
+  return distances.data() + offsets[id];
+}
@@ -0,0 +1,30 @@
+#ifndef KDNEIGHBOURSCLASS_HEADER
+#define KDNEIGHBOURSCLASS_HEADER
+
+#include <stddef.h>
+#include <vector>
+
+// The neighbours of all units of a tree, in compressed sparse row form, i.e.
+// the neighbours of unit id are found at positions [offsets[id], offsets[id + 1])
+// of ids and distances, ordered by distance. Units that were not searched have
+// no neighbours. The number of nodes and leaves visited by the searches are
+// kept as well.
+class KDNeighbours {
+public:
+  size_t N = 0;
+  std::vector<size_t> offsets = std::vector<size_t>(1, 0);
+  std::vector<size_t> ids = std::vector<size_t>(0);
+  std::vector<double> distances = std::vector<double>(0);
+  size_t visitedNodes = 0;
+  size_t visitedLeaves = 0;
+
+  KDNeighbours();
+  ~KDNeighbours();
+  void Reset(const size_t);
+
+  size_t GetSize(const size_t) const;
+  const size_t* GetIds(const size_t) const;
+  const double* GetDistances(const size_t) const;
+};
+
+#endif
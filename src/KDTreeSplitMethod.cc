@@ -0,0 +1,11 @@
+#include <stdexcept>
+
+#include "KDTreeSplitMethod.h"
+
+KDTreeSplitMethod IntToKDTreeSplitMethod(const int i) {
+  if (0 <= i && i <= 2)
+    return static_cast<KDTreeSplitMethod>(i);
+
+  throw std::invalid_argument("split method does not exist");
+  return KDTreeSplitMethod::midpointSlide;
+}
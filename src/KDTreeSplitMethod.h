@@ -0,0 +1,13 @@
+#ifndef KDTREESPLITMETHOD_HEADER
+#define KDTREESPLITMETHOD_HEADER
+
+// The rule used to split the nodes of KDFlatTree
+enum class KDTreeSplitMethod {
+  variable = 0,
+  maximalSpread = 1,
+  midpointSlide = 2
+};
+
+KDTreeSplitMethod IntToKDTreeSplitMethod(const int);
+
+#endif
@@ -0,0 +1,142 @@
+#include <algorithm>
+#include <stddef.h>
+#include <vector>
+
+#include "KeyIndex.h"
+
+const size_t KeyIndex::npos;
+
+KeyIndex::KeyIndex() {}
+
+KeyIndex::KeyIndex(const int *keys, const size_t n) {
+  Build(keys, n);
+}
+
+/*
+ * Builds the index. A direct address table is used if the range of the keys is
+ * at most 4 times the number of keys (or small in itself).
+ */
+void KeyIndex::Build(const int *keys, const size_t n) {
+  size_ = n;
+  n_duplicates_ = 0;
+  table_.clear();
+  sorted_keys_.clear();
+  sorted_positions_.clear();
+
+  if (n == 0) {
+    direct_ = true;
+    min_key_ = 0;
+    return;
+  }
+
+  long long min_key = keys[0];
+  long long max_key = keys[0];
+
+  for (size_t i = 1; i < n; i++) {
+    min_key = std::min(min_key, (long long)keys[i]);
+    max_key = std::max(max_key, (long long)keys[i]);
+  }
+
+  size_t range = (size_t)(max_key - min_key) + 1;
+  direct_ = range <= 4 * n || range <= 1024;
+  min_key_ = min_key;
+
+  if (direct_) {
+    table_.assign(range, npos);
+
+    for (size_t i = 0; i < n; i++) {
+      size_t *position = &table_[(size_t)(keys[i] - min_key_)];
+
+      if (*position != npos) {
+        n_duplicates_ += 1;
+        continue;
+      }
+
+      *position = i;
+    }
+
+    return;
+  }
+
+  std::vector<size_t> order(n);
+  for (size_t i = 0; i < n; i++) order[i] = i;
+  std::stable_sort(
+    order.begin(),
+    order.end(),
+    [keys](size_t a, size_t b) { return keys[a] < keys[b]; }
+    );
+
+  sorted_keys_.reserve(n);
+  sorted_positions_.reserve(n);
+
+  for (size_t i = 0; i < n; i++) {
+    int key = keys[order[i]];
+
+    if (i > 0 && key == sorted_keys_.back()) {
+      n_duplicates_ += 1;
+      continue;
+    }
+
+    sorted_keys_.push_back(key);
+    sorted_positions_.push_back(order[i]);
+  }
+
+  return;
+}
+
+/*
+ * Returns the position of a key, or npos if the key does not exist
+ */
+size_t KeyIndex::Find(const int key) const {
+  if (direct_) {
+    long long offset = (long long)key - min_key_;
+
+    if (offset < 0 || (size_t)offset >= table_.size()) {
+      return npos;
+    }
+
+    return table_[(size_t)offset];
+  }
+
+  std::vector<int>::const_iterator it =
+    std::lower_bound(sorted_keys_.begin(), sorted_keys_.end(), key);
+
+  if (it == sorted_keys_.end() || *it != key) {
+    return npos;
+  }
+
+  return sorted_positions_[it - sorted_keys_.begin()];
+}
+
+/*
+ * Finds the positions of an array of keys in one pass, i.e.
+ * positions[i] = Find(keys[i])
+ */
+void KeyIndex::FindAll(const int *keys, const size_t n, size_t *positions) const {
+  if (!direct_) {
+    for (size_t i = 0; i < n; i++) {
+      positions[i] = Find(keys[i]);
+    }
+
+    return;
+  }
+
+  const size_t *table = table_.data();
+  size_t range = table_.size();
+
+  for (size_t i = 0; i < n; i++) {
+    // Keys below min_key_ wrap around to offsets >= range
+    size_t offset = (size_t)((long long)keys[i] - min_key_);
+    positions[i] = offset < range ? table[offset] : npos;
+  }
+
+  return;
+}
+
+size_t KeyIndex::Size() const {
+  return size_;
+}
+
+size_t KeyIndex::NumDuplicates() const {
+  return n_duplicates_;
+}
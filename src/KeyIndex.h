@@ -0,0 +1,35 @@
+#ifndef KEYINDEX_HEADER
+#define KEYINDEX_HEADER
+
+#include <stddef.h>
+#include <vector>
+
+// Index of a set of (external) integer keys, mapping each key to its position.
+// If the keys are compact, i.e. the range of the keys is not much larger than
+// the number of keys, the positions are stored in a direct address table.
+// Otherwise, the keys are stored in a sorted array, and looked up by binary
+// search. If a key occurs more than once, its first position is used.
+
+class KeyIndex {
+public:
+  static const size_t npos = (size_t)-1;
+
+  bool direct_ = true;
+  long long min_key_ = 0;
+  std::vector<size_t> table_; // Direct: position of key min_key_ + i
+  std::vector<int> sorted_keys_; // Sorted
+  std::vector<size_t> sorted_positions_; // Sorted
+  size_t size_ = 0;
+  size_t n_duplicates_ = 0;
+
+  KeyIndex();
+  KeyIndex(const int*, const size_t);
+  void Build(const int*, const size_t);
+
+  size_t Find(const int) const;
+  void FindAll(const int*, const size_t, size_t*) const;
+  size_t Size() const;
+  size_t NumDuplicates() const;
+};
+
+#endif
@@ -3,14 +3,16 @@
 #include <string>
 #include <vector>
 
+#include "KeyIndex.h"
 #include "KeyValueMap.h"
 
-KeyValueMap::KeyValueMap(int *keys, size_t n) {
+KeyValueMap::KeyValueMap(const int *keys, size_t n) {
   if (n == 0) {
     throw std::range_error("(KeyValueMap::KeyValueMap) n = 0");
   }
 
-  keys_ = keys;
+  keys_.assign(keys, keys + n);
+  index_.Build(keys_.data(), n);
   size_ = n;
   values_.reserve(n);
 
@@ -26,17 +28,24 @@ int KeyValueMap::GetExternalKey(size_t internal_key) const {
 }
 
 size_t KeyValueMap::GetInternalKey(int external_key) const {
-  size_t n = Size();
+  size_t internal_key = index_.Find(external_key);
 
-  for (size_t i = 0; i < n; i++) {
-    if (keys_[i] == external_key) {
-      return i;
-    }
+  if (internal_key != KeyIndex::npos) {
+    return internal_key;
   }
 
   throw std::range_error("(KeyValueMap::GetInternalKey) key not found: " + std::to_string(external_key));
 }
 
+/*
+ * Non-throwing version of GetInternalKey. Returns false if the key does not
+ * exist.
+ */
+bool KeyValueMap::FindInternalKey(int external_key, size_t *internal_key) const {
+  *internal_key = index_.Find(external_key);
+  return *internal_key != KeyIndex::npos;
+}
+
 size_t KeyValueMap::GetValue(size_t internal_key) const {
   if (internal_key >= size_) {
     throw std::out_of_range("(KeyValueMap::GetValue) oob: " + std::to_string(internal_key));
@@ -45,6 +54,10 @@ size_t KeyValueMap::GetValue(size_t internal_key) const {
   return values_[internal_key];
 }
 
+size_t KeyValueMap::GetValueUnchecked(size_t internal_key) const {
+  return values_[internal_key];
+}
+
 size_t KeyValueMap::Size() const {
   return size_;
 }
@@ -4,18 +4,27 @@
 #include <stddef.h>
 #include <vector>
 
+#include "KeyIndex.h"
+
 // InternalKey <ExternalKey, value>
+// The external keys are indexed once at construction, so that the lookup of
+// an internal key is O(1) (or O(log n) for very sparse keys).
+// The unchecked accessors are meant for loops where the internal keys have
+// already been validated.
 
 class KeyValueMap {
 public:
-  int *keys_ = nullptr;
+  std::vector<int> keys_;
+  KeyIndex index_;
   size_t size_ = 0;
   std::vector<size_t> values_;
 
-  KeyValueMap(int*, size_t);
+  KeyValueMap(const int*, size_t);
   int GetExternalKey(size_t) const;
   size_t GetInternalKey(int) const;
+  bool FindInternalKey(int, size_t*) const;
   size_t GetValue(size_t) const;
+  size_t GetValueUnchecked(size_t) const;
   size_t Size() const;
 };
 
@@ -0,0 +1,93 @@
+#include <stddef.h>
+#include <stdexcept>
+#include <vector>
+
+#include "KeyValueMap.h"
+#include "NilsDesign.h"
+#include "TractStore.h"
+
+/*
+ * Create a design from the tracts (ids and external psus), psus and categories.
+ * The neighbourhood sizes are set by SetBalancing.
+ */
+NilsDesign::NilsDesign(
+  const int *tract_ids,
+  const int *tract_external_psus,
+  const size_t n_tracts,
+  const KeyValueMap &psus,
+  const KeyValueMap &categories,
+  const double area,
+  const double tract_area
+) :
+  psus_(psus),
+  categories_(categories),
+  neighbours_(psus),
+  tract_store_(tract_ids, tract_external_psus, n_tracts, psus, categories)
+{
+  area_ = area;
+  tract_area_ = tract_area;
+  return;
+}
+
+/*
+ * Search the neighbourhoods of the tracts of each level once, for the balanced
+ * variance, using p_xbalance balancing variables per tract, in the input order
+ * of the tracts. See TractStore::FindBalancedNeighbours.
+ */
+void NilsDesign::SetBalancing(
+  double *xbalance,
+  const size_t p_xbalance,
+  const KeyValueMap &neighbours,
+  const NeighbourSearch &search,
+  const size_t n_threads
+) {
+  if (neighbours.Size() != psus_.Size()) {
+    throw std::range_error("(NilsDesign::SetBalancing) neighbours.size != psus.size");
+  }
+
+  neighbours_ = neighbours;
+  search_ = search;
+
+  tract_store_.SetThreads(n_threads);
+  level_neighbours_ = tract_store_.FindBalancedNeighbours(
+    psus_,
+    categories_,
+    xbalance,
+    p_xbalance,
+    neighbours_,
+    search_
+  );
+  tract_store_.SetThreads(1);
+
+  balanced_ = true;
+  return;
+}
+
+bool NilsDesign::IsBalanced() const {
+  return balanced_;
+}
+
+size_t NilsDesign::Size() const {
+  return tract_store_.Size();
+}
+
+/*
+ * Create an empty TractStore of the design, for n_plots plots of n_vars
+ * variables in n_domains domains, using n_threads threads
+ */
+TractStore NilsDesign::CreateTractStore(
+  const size_t n_vars,
+  const size_t n_domains,
+  const size_t n_plots,
+  const size_t n_threads
+) const {
+  TractStore tract_store(tract_store_);
+  tract_store.Allocate(
+    n_vars,
+    n_domains,
+    TractStore::ChooseStorage(n_plots, Size(), categories_.Size())
+  );
+  tract_store.SetThreads(n_threads);
+
+  return tract_store;
+}
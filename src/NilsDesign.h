@@ -0,0 +1,47 @@
+#ifndef NILSDESIGN_HEADER
+#define NILSDESIGN_HEADER
+
+#include <stddef.h>
+#include <vector>
+
+#include "KDNeighboursClass.h"
+#include "KeyValueMap.h"
+#include "TractStore.h"
+
+// A prepared NILS design: everything derived from the tracts, the psus, the
+// categories and, for the balanced variance, the balancing variables, i.e.
+// everything that does not depend on the plots. It is built once, and shared
+// by the estimates of any number of variables.
+// tract_store_ holds the order of the tracts and categories, but no values; it
+// is copied and allocated per estimate by CreateTractStore. The neighbourhoods
+// of the tracts are searched once, by SetBalancing.
+class NilsDesign {
+public:
+  KeyValueMap psus_;
+  KeyValueMap categories_;
+  KeyValueMap neighbours_; // Balanced only, the neighbourhood size per psu
+  TractStore tract_store_;
+  double area_;
+  double tract_area_;
+  bool balanced_ = false;
+  std::vector<KDNeighbours> level_neighbours_; // Balanced only, per internal psu
+  NeighbourSearch search_; // Balanced only
+
+  NilsDesign(
+    const int*,
+    const int*,
+    const size_t,
+    const KeyValueMap&,
+    const KeyValueMap&,
+    const double,
+    const double
+  );
+
+  void SetBalancing(double*, const size_t, const KeyValueMap&, const NeighbourSearch&, const size_t);
+  bool IsBalanced() const;
+  size_t Size() const;
+
+  TractStore CreateTractStore(const size_t, const size_t, const size_t, const size_t) const;
+};
+
+#endif
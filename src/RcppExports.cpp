@@ -11,8 +11,8 @@ Rcpp::Rostream<false>& Rcpp::Rcerr = Rcpp::Rcpp_cerr_get();
 #endif
 
 // NilsEstimate
-Rcpp::List NilsEstimate(const Rcpp::IntegerMatrix& r_ordered_psu_size, const Rcpp::IntegerMatrix& r_cat_psu, const Rcpp::IntegerMatrix& r_tracts, const Rcpp::DataFrame& r_plot_data, const double area, const double tract_area);
-RcppExport SEXP _nilsier_NilsEstimate(SEXP r_ordered_psu_sizeSEXP, SEXP r_cat_psuSEXP, SEXP r_tractsSEXP, SEXP r_plot_dataSEXP, SEXP areaSEXP, SEXP tract_areaSEXP) {
+Rcpp::List NilsEstimate(const Rcpp::IntegerMatrix& r_ordered_psu_size, const Rcpp::IntegerMatrix& r_cat_psu, const Rcpp::IntegerMatrix& r_tracts, const Rcpp::DataFrame& r_plot_data, const Rcpp::IntegerVector& r_domains, const int n_domains, const double area, const double tract_area, const bool fail_fast, const int threads);
+RcppExport SEXP _nilsier_NilsEstimate(SEXP r_ordered_psu_sizeSEXP, SEXP r_cat_psuSEXP, SEXP r_tractsSEXP, SEXP r_plot_dataSEXP, SEXP r_domainsSEXP, SEXP n_domainsSEXP, SEXP areaSEXP, SEXP tract_areaSEXP, SEXP fail_fastSEXP, SEXP threadsSEXP) {
 BEGIN_RCPP
     Rcpp::RObject rcpp_result_gen;
     Rcpp::RNGScope rcpp_rngScope_gen;
@@ -20,15 +20,19 @@ BEGIN_RCPP
     Rcpp::traits::input_parameter< const Rcpp::IntegerMatrix& >::type r_cat_psu(r_cat_psuSEXP);
     Rcpp::traits::input_parameter< const Rcpp::IntegerMatrix& >::type r_tracts(r_tractsSEXP);
     Rcpp::traits::input_parameter< const Rcpp::DataFrame& >::type r_plot_data(r_plot_dataSEXP);
+    Rcpp::traits::input_parameter< const Rcpp::IntegerVector& >::type r_domains(r_domainsSEXP);
+    Rcpp::traits::input_parameter< const int >::type n_domains(n_domainsSEXP);
     Rcpp::traits::input_parameter< const double >::type area(areaSEXP);
     Rcpp::traits::input_parameter< const double >::type tract_area(tract_areaSEXP);
-    rcpp_result_gen = Rcpp::wrap(NilsEstimate(r_ordered_psu_size, r_cat_psu, r_tracts, r_plot_data, area, tract_area));
+    Rcpp::traits::input_parameter< const bool >::type fail_fast(fail_fastSEXP);
+    Rcpp::traits::input_parameter< const int >::type threads(threadsSEXP);
+    rcpp_result_gen = Rcpp::wrap(NilsEstimate(r_ordered_psu_size, r_cat_psu, r_tracts, r_plot_data, r_domains, n_domains, area, tract_area, fail_fast, threads));
     return rcpp_result_gen;
 END_RCPP
 }
 // NilsBalancedEstimate
-Rcpp::List NilsBalancedEstimate(const Rcpp::IntegerMatrix& r_ordered_psu_size, const Rcpp::IntegerMatrix& r_cat_psu, const Rcpp::IntegerMatrix& r_tracts, const Rcpp::DataFrame& r_plot_data, const double area, const double tract_area, Rcpp::NumericMatrix& r_xbalance);
-RcppExport SEXP _nilsier_NilsBalancedEstimate(SEXP r_ordered_psu_sizeSEXP, SEXP r_cat_psuSEXP, SEXP r_tractsSEXP, SEXP r_plot_dataSEXP, SEXP areaSEXP, SEXP tract_areaSEXP, SEXP r_xbalanceSEXP) {
+Rcpp::List NilsBalancedEstimate(const Rcpp::IntegerMatrix& r_ordered_psu_size, const Rcpp::IntegerMatrix& r_cat_psu, const Rcpp::IntegerMatrix& r_tracts, const Rcpp::DataFrame& r_plot_data, const Rcpp::IntegerVector& r_domains, const int n_domains, const double area, const double tract_area, const bool fail_fast, const int threads, Rcpp::NumericMatrix& r_xbalance, const int bucket_size, const int split_method, const double eps, const int max_leaves, const int neighbour_index);
+RcppExport SEXP _nilsier_NilsBalancedEstimate(SEXP r_ordered_psu_sizeSEXP, SEXP r_cat_psuSEXP, SEXP r_tractsSEXP, SEXP r_plot_dataSEXP, SEXP r_domainsSEXP, SEXP n_domainsSEXP, SEXP areaSEXP, SEXP tract_areaSEXP, SEXP fail_fastSEXP, SEXP threadsSEXP, SEXP r_xbalanceSEXP, SEXP bucket_sizeSEXP, SEXP split_methodSEXP, SEXP epsSEXP, SEXP max_leavesSEXP, SEXP neighbour_indexSEXP) {
 BEGIN_RCPP
     Rcpp::RObject rcpp_result_gen;
     Rcpp::RNGScope rcpp_rngScope_gen;
@@ -36,17 +40,83 @@ BEGIN_RCPP
     Rcpp::traits::input_parameter< const Rcpp::IntegerMatrix& >::type r_cat_psu(r_cat_psuSEXP);
     Rcpp::traits::input_parameter< const Rcpp::IntegerMatrix& >::type r_tracts(r_tractsSEXP);
     Rcpp::traits::input_parameter< const Rcpp::DataFrame& >::type r_plot_data(r_plot_dataSEXP);
+    Rcpp::traits::input_parameter< const Rcpp::IntegerVector& >::type r_domains(r_domainsSEXP);
+    Rcpp::traits::input_parameter< const int >::type n_domains(n_domainsSEXP);
     Rcpp::traits::input_parameter< const double >::type area(areaSEXP);
     Rcpp::traits::input_parameter< const double >::type tract_area(tract_areaSEXP);
+    Rcpp::traits::input_parameter< const bool >::type fail_fast(fail_fastSEXP);
+    Rcpp::traits::input_parameter< const int >::type threads(threadsSEXP);
     Rcpp::traits::input_parameter< Rcpp::NumericMatrix& >::type r_xbalance(r_xbalanceSEXP);
-    rcpp_result_gen = Rcpp::wrap(NilsBalancedEstimate(r_ordered_psu_size, r_cat_psu, r_tracts, r_plot_data, area, tract_area, r_xbalance));
+    Rcpp::traits::input_parameter< const int >::type bucket_size(bucket_sizeSEXP);
+    Rcpp::traits::input_parameter< const int >::type split_method(split_methodSEXP);
+    Rcpp::traits::input_parameter< const double >::type eps(epsSEXP);
+    Rcpp::traits::input_parameter< const int >::type max_leaves(max_leavesSEXP);
+    Rcpp::traits::input_parameter< const int >::type neighbour_index(neighbour_indexSEXP);
+    rcpp_result_gen = Rcpp::wrap(NilsBalancedEstimate(r_ordered_psu_size, r_cat_psu, r_tracts, r_plot_data, r_domains, n_domains, area, tract_area, fail_fast, threads, r_xbalance, bucket_size, split_method, eps, max_leaves, neighbour_index));
+    return rcpp_result_gen;
+END_RCPP
+}
+// NilsDesignCreate
+Rcpp::List NilsDesignCreate(const Rcpp::IntegerMatrix& r_ordered_psu_size, const Rcpp::IntegerMatrix& r_cat_psu, const Rcpp::IntegerMatrix& r_tracts, const double area, const double tract_area);
+RcppExport SEXP _nilsier_NilsDesignCreate(SEXP r_ordered_psu_sizeSEXP, SEXP r_cat_psuSEXP, SEXP r_tractsSEXP, SEXP areaSEXP, SEXP tract_areaSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< const Rcpp::IntegerMatrix& >::type r_ordered_psu_size(r_ordered_psu_sizeSEXP);
+    Rcpp::traits::input_parameter< const Rcpp::IntegerMatrix& >::type r_cat_psu(r_cat_psuSEXP);
+    Rcpp::traits::input_parameter< const Rcpp::IntegerMatrix& >::type r_tracts(r_tractsSEXP);
+    Rcpp::traits::input_parameter< const double >::type area(areaSEXP);
+    Rcpp::traits::input_parameter< const double >::type tract_area(tract_areaSEXP);
+    rcpp_result_gen = Rcpp::wrap(NilsDesignCreate(r_ordered_psu_size, r_cat_psu, r_tracts, area, tract_area));
+    return rcpp_result_gen;
+END_RCPP
+}
+// NilsBalancedDesignCreate
+Rcpp::List NilsBalancedDesignCreate(const Rcpp::IntegerMatrix& r_ordered_psu_size, const Rcpp::IntegerMatrix& r_cat_psu, const Rcpp::IntegerMatrix& r_tracts, const double area, const double tract_area, const int threads, Rcpp::NumericMatrix& r_xbalance, const int bucket_size, const int split_method, const double eps, const int max_leaves, const int neighbour_index);
+RcppExport SEXP _nilsier_NilsBalancedDesignCreate(SEXP r_ordered_psu_sizeSEXP, SEXP r_cat_psuSEXP, SEXP r_tractsSEXP, SEXP areaSEXP, SEXP tract_areaSEXP, SEXP threadsSEXP, SEXP r_xbalanceSEXP, SEXP bucket_sizeSEXP, SEXP split_methodSEXP, SEXP epsSEXP, SEXP max_leavesSEXP, SEXP neighbour_indexSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< const Rcpp::IntegerMatrix& >::type r_ordered_psu_size(r_ordered_psu_sizeSEXP);
+    Rcpp::traits::input_parameter< const Rcpp::IntegerMatrix& >::type r_cat_psu(r_cat_psuSEXP);
+    Rcpp::traits::input_parameter< const Rcpp::IntegerMatrix& >::type r_tracts(r_tractsSEXP);
+    Rcpp::traits::input_parameter< const double >::type area(areaSEXP);
+    Rcpp::traits::input_parameter< const double >::type tract_area(tract_areaSEXP);
+    Rcpp::traits::input_parameter< const int >::type threads(threadsSEXP);
+    Rcpp::traits::input_parameter< Rcpp::NumericMatrix& >::type r_xbalance(r_xbalanceSEXP);
+    Rcpp::traits::input_parameter< const int >::type bucket_size(bucket_sizeSEXP);
+    Rcpp::traits::input_parameter< const int >::type split_method(split_methodSEXP);
+    Rcpp::traits::input_parameter< const double >::type eps(epsSEXP);
+    Rcpp::traits::input_parameter< const int >::type max_leaves(max_leavesSEXP);
+    Rcpp::traits::input_parameter< const int >::type neighbour_index(neighbour_indexSEXP);
+    rcpp_result_gen = Rcpp::wrap(NilsBalancedDesignCreate(r_ordered_psu_size, r_cat_psu, r_tracts, area, tract_area, threads, r_xbalance, bucket_size, split_method, eps, max_leaves, neighbour_index));
+    return rcpp_result_gen;
+END_RCPP
+}
+// NilsDesignEstimate
+Rcpp::List NilsDesignEstimate(SEXP r_design, const Rcpp::DataFrame& r_plot_data, const Rcpp::IntegerVector& r_domains, const int n_domains, const bool fail_fast, const int threads, const bool balanced);
+RcppExport SEXP _nilsier_NilsDesignEstimate(SEXP r_designSEXP, SEXP r_plot_dataSEXP, SEXP r_domainsSEXP, SEXP n_domainsSEXP, SEXP fail_fastSEXP, SEXP threadsSEXP, SEXP balancedSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< SEXP >::type r_design(r_designSEXP);
+    Rcpp::traits::input_parameter< const Rcpp::DataFrame& >::type r_plot_data(r_plot_dataSEXP);
+    Rcpp::traits::input_parameter< const Rcpp::IntegerVector& >::type r_domains(r_domainsSEXP);
+    Rcpp::traits::input_parameter< const int >::type n_domains(n_domainsSEXP);
+    Rcpp::traits::input_parameter< const bool >::type fail_fast(fail_fastSEXP);
+    Rcpp::traits::input_parameter< const int >::type threads(threadsSEXP);
+    Rcpp::traits::input_parameter< const bool >::type balanced(balancedSEXP);
+    rcpp_result_gen = Rcpp::wrap(NilsDesignEstimate(r_design, r_plot_data, r_domains, n_domains, fail_fast, threads, balanced));
     return rcpp_result_gen;
 END_RCPP
 }
 
 static const R_CallMethodDef CallEntries[] = {
-    {"_nilsier_NilsEstimate", (DL_FUNC) &_nilsier_NilsEstimate, 6},
-    {"_nilsier_NilsBalancedEstimate", (DL_FUNC) &_nilsier_NilsBalancedEstimate, 7},
+    {"_nilsier_NilsEstimate", (DL_FUNC) &_nilsier_NilsEstimate, 10},
+    {"_nilsier_NilsBalancedEstimate", (DL_FUNC) &_nilsier_NilsBalancedEstimate, 16},
+    {"_nilsier_NilsDesignCreate", (DL_FUNC) &_nilsier_NilsDesignCreate, 5},
+    {"_nilsier_NilsBalancedDesignCreate", (DL_FUNC) &_nilsier_NilsBalancedDesignCreate, 12},
+    {"_nilsier_NilsDesignEstimate", (DL_FUNC) &_nilsier_NilsDesignEstimate, 7},
     {NULL, NULL, 0}
 };
 
@@ -1,188 +1,648 @@
 #include <algorithm>
+#include <array>
 #include <limits>
+#include <memory>
 #include <vector>
 #include <stddef.h>
 #include <stdexcept>
-
-#include <Rcpp.h>
-
-#include "KDStoreClass.h"
-#include "KDTreeClass.h"
+#include <string>
+#include <utility>
+
+#include "KDBallTreeClass.h"
+#include "KDFlatTreeClass.h"
+#include "KDGridClass.h"
+#include "KDNeighboursClass.h"
+#include "KDTreeSplitMethod.h"
 #include "KeyValueMap.h"
 #include "TractStore.h"
 
-Tract::Tract(const size_t n_cats, const int id, const size_t psu) {
-  values_ = std::vector<double>(n_cats, 0.0);
-  external_id_ = id;
-  internal_psu_ = psu;
+PlotData::PlotData(
+  const int *tract_ids,
+  const int *cats,
+  const double *weights,
+  const size_t n
+) {
+  tract_ids_ = tract_ids;
+  cats_ = cats;
+  weights_ = weights;
+  size_ = n;
   return;
 }
 
-void Tract::Add(const size_t cat, const double value) {
-  values_[cat] += value;
+void PlotData::AddValues(const double *values) {
+  values_.push_back(values);
+}
 
-  if (!recorded_) {
-    recorded_ = true;
+void PlotData::SetDomains(const int *domains, const size_t n_domains) {
+  if (n_domains == 0) {
+    throw std::range_error("(PlotData::SetDomains) n_domains = 0");
   }
 
-  if (!nonnil_ && value != 0.0) {
-    nonnil_ = true;
+  domains_ = domains;
+  n_domains_ = n_domains;
+  return;
+}
+
+size_t PlotData::Size() const {
+  return size_;
+}
+
+size_t PlotData::NumVars() const {
+  return values_.size();
+}
+
+size_t PlotData::NumDomains() const {
+  return n_domains_;
+}
+
+/*
+ * The domain of plot i, or 0 if no domains have been set
+ */
+size_t PlotData::GetDomain(const size_t i) const {
+  if (domains_ == nullptr) {
+    return 0;
   }
+
+  return (size_t)domains_[i];
 }
 
-double Tract::Get(const size_t cat) const {
-  return values_[cat];
+FillDiagnostics::FillDiagnostics() {}
+
+FillDiagnostics::FillDiagnostics(const bool fail_fast) {
+  fail_fast_ = fail_fast;
 }
 
-double Tract::Sum() const {
-  if (!nonnil_) {
-    return 0.0;
+/*
+ * Records a plot (0-based row) whose tract does not exist
+ */
+void FillDiagnostics::AddMissingTract(const size_t plot, const int tract_id) {
+  if (fail_fast_) {
+    throw std::range_error(
+      std::string("Tract of plot ") + std::to_string(plot+1)
+      + std::string(" (") + std::to_string(tract_id)
+      + std::string(") does not exist")
+      );
+  }
+
+  n_missing_tracts_ += 1;
+
+  if (missing_tract_rows_.size() < max_rows_) {
+    missing_tract_rows_.push_back(plot + 1);
+  }
+}
+
+/*
+ * Records a plot (0-based row) whose category does not match the PSU of its
+ * tract
+ */
+void FillDiagnostics::AddPsuMismatch(const size_t plot, const int tract_id) {
+  if (fail_fast_) {
+    throw std::range_error(
+      std::string("Category of plot ") + std::to_string(plot+1)
+      + std::string(" does not match PSU of tract ") + std::to_string(tract_id)
+      );
   }
 
-  double sum = 0.0;
-  for (size_t i = values_.size(); i --> 0; ) {
-    sum += values_[i];
+  n_psu_mismatches_ += 1;
+
+  if (psu_mismatch_rows_.size() < max_rows_) {
+    psu_mismatch_rows_.push_back(plot + 1);
   }
-  return sum;
 }
 
-size_t Tract::GetInternalPsu() const {
-  return internal_psu_;
+size_t FillDiagnostics::NumIssues() const {
+  return n_missing_tracts_ + n_psu_mismatches_;
 }
 
 /*
- * Create a TractMap from an array of indices
+ * Create a TractStore without targets from an array of indices, i.e. only the
+ * order of the tracts and categories. See Allocate.
  */
 TractStore::TractStore(
   const int *tract_ids,
   const int *tract_external_psus,
   const size_t n_tracts,
   const KeyValueMap &psus,
-  const size_t n_cats
+  const KeyValueMap &categories
 ) {
-  n_cats_ = n_cats;
+  storage_ = TractStorage::dense;
+  n_tracts_ = n_tracts;
+  n_cats_ = categories.Size();
 
   if (n_tracts != psus.GetValue(0)) {
     throw std::range_error("(TractStore::TractStore) n_tracts != largest psu");
   }
 
-  tract_map_.reserve(n_tracts);
-  internal_id_map_.reserve(n_tracts);
+  std::vector<size_t> tract_psus(n_tracts);
+  for (size_t i = 0; i < n_tracts; i++) {
+    tract_psus[i] = psus.GetInternalKey(tract_external_psus[i]);
+  }
+
+  // Order the tracts by psu, smallest psu (i.e. largest internal psu) first,
+  // by bucketing the tracts per psu. The order within a psu is kept.
+  size_t n_psus = psus.Size();
+  level_ends_.assign(n_psus, 0);
 
   for (size_t i = 0; i < n_tracts; i++) {
-    TractInternalId::const_iterator it = internal_id_map_.find(tract_ids[i]);
-    if (it != internal_id_map_.end()) {
-      throw std::range_error("(TractStore::TractStore) duplicate tract_id provided");
-    }
+    level_ends_[tract_psus[i]] += 1;
+  }
+
+  for (size_t psu = n_psus - 1; psu --> 0;) {
+    level_ends_[psu] += level_ends_[psu + 1];
+  }
+
+  std::vector<size_t> level_starts(n_psus);
+  for (size_t psu = 0; psu < n_psus; psu++) {
+    level_starts[psu] = psu + 1 < n_psus ? level_ends_[psu + 1] : 0;
+  }
 
-    int external_id = tract_ids[i];
-    int external_psu = tract_external_psus[i];
+  input_rows_.resize(n_tracts);
+  for (size_t i = 0; i < n_tracts; i++) {
+    input_rows_[level_starts[tract_psus[i]]++] = i;
+  }
+
+  external_ids_.resize(n_tracts);
+  internal_psus_.resize(n_tracts);
+
+  for (size_t row = 0; row < n_tracts; row++) {
+    size_t i = input_rows_[row];
+    external_ids_[row] = tract_ids[i];
+    internal_psus_[row] = tract_psus[i];
+  }
+
+  row_index_.Build(external_ids_.data(), n_tracts);
+
+  if (row_index_.NumDuplicates() > 0) {
+    throw std::range_error("(TractStore::TractStore) duplicate tract_id provided");
+  }
+
+  // Order the categories by psu, smallest psu first
+  cat_order_.resize(n_cats_);
+  for (size_t cat = 0; cat < n_cats_; cat++) cat_order_[cat] = cat;
+  std::stable_sort(
+    cat_order_.begin(),
+    cat_order_.end(),
+    [&categories](size_t a, size_t b) { return categories.GetValue(a) > categories.GetValue(b); }
+    );
 
-    tract_map_.push_back(Tract(n_cats, external_id, psus.GetInternalKey(external_psu)));
-    internal_id_map_.emplace(external_id, i);
+  cat_columns_.resize(n_cats_);
+  for (size_t col = 0; col < n_cats_; col++) {
+    cat_columns_[cat_order_[col]] = col;
   }
 
   return;
 }
 
-Tract* TractStore::FindInternal(const size_t internal_id) {
-  return &tract_map_[internal_id];
+/*
+ * Create a TractStore from an array of indices
+ */
+TractStore::TractStore(
+  const int *tract_ids,
+  const int *tract_external_psus,
+  const size_t n_tracts,
+  const KeyValueMap &psus,
+  const KeyValueMap &categories,
+  const size_t n_vars,
+  const size_t n_domains,
+  const TractStorage storage
+) : TractStore(tract_ids, tract_external_psus, n_tracts, psus, categories) {
+  Allocate(n_vars, n_domains, storage);
+  return;
 }
 
-Tract* TractStore::FindExternal(const int external_id) {
-  TractInternalId::const_iterator it = internal_id_map_.find(external_id);
+/*
+ * Allocate the (zeroed) values of n_vars variables in n_domains domains. Any
+ * previous values are discarded.
+ */
+void TractStore::Allocate(const size_t n_vars, const size_t n_domains, const TractStorage storage) {
+  if (n_vars * n_domains == 0) {
+    throw std::range_error("(TractStore::Allocate) n_vars * n_domains = 0");
+  }
+
+  storage_ = storage;
+  n_domains_ = n_domains;
+  n_targets_ = n_vars * n_domains;
+
+  values_.clear();
+  sparse_offsets_.clear();
+  sparse_cols_.clear();
+  sparse_values_.clear();
+
+  if (storage_ == TractStorage::dense) {
+    values_.assign(n_targets_ * n_cats_ * n_tracts_, 0.0);
+  } else {
+    sparse_offsets_.assign(n_targets_ * n_tracts_ + 1, 0);
+  }
+
+  nonnil_.assign(n_targets_ * n_tracts_, 0);
 
-  if (it == internal_id_map_.end()) {
-    return nullptr;
+  return;
+}
+
+/*
+ * Choose the storage for a set of plots. Each plot fills at most one cell per
+ * target, so if the plots can fill at most a small share of the cells, the
+ * sparse storage is used.
+ */
+TractStorage TractStore::ChooseStorage(
+  const size_t n_plots,
+  const size_t n_tracts,
+  const size_t n_cats
+) {
+  if (n_plots * 8 < n_tracts * n_cats) {
+    return TractStorage::sparse;
   }
 
-  return FindInternal(it->second);
+  return TractStorage::dense;
+}
+
+/*
+ * Finds the row of the tract with some external id. Returns false if the tract
+ * does not exist.
+ */
+bool TractStore::FindExternal(const int external_id, size_t *row) const {
+  *row = row_index_.Find(external_id);
+  return *row != KeyIndex::npos;
+}
+
+/*
+ * Finds the rows of an array of external ids in one pass. Ids that does not
+ * exist get the row KeyIndex::npos.
+ */
+void TractStore::FindExternalAll(const int *external_ids, const size_t n, size_t *rows) const {
+  row_index_.FindAll(external_ids, n, rows);
+}
+
+void TractStore::SetThreads(const size_t n_threads) {
+  n_threads_ = n_threads > 0 ? n_threads : 1;
 }
 
 size_t TractStore::Size() const {
-  return tract_map_.size();
+  return n_tracts_;
+}
+
+size_t TractStore::NumTargets() const {
+  return n_targets_;
+}
+
+double TractStore::Get(const size_t row, const size_t col, const size_t target) const {
+  if (storage_ == TractStorage::dense) {
+    return values_[(target * n_cats_ + col) * n_tracts_ + row];
+  }
+
+  size_t key = target * n_tracts_ + row;
+  std::vector<size_t>::const_iterator first = sparse_cols_.begin() + sparse_offsets_[key];
+  std::vector<size_t>::const_iterator last = sparse_cols_.begin() + sparse_offsets_[key + 1];
+  std::vector<size_t>::const_iterator it = std::lower_bound(first, last, col);
+
+  if (it == last || *it != col) {
+    return 0.0;
+  }
+
+  return sparse_values_[it - sparse_cols_.begin()];
 }
 
 /*
- * Fill the TractMap with values from a data frame w/ a certain design:
- * Columns (in order): tract id, category, weight, value
+ * Only available in dense storage
+ */
+void TractStore::Add(const size_t row, const size_t col, const size_t target, const double value) {
+  values_[(target * n_cats_ + col) * n_tracts_ + row] += value;
+
+  if (value != 0.0) {
+    nonnil_[target * n_tracts_ + row] = 1;
+  }
+}
+
+/*
+ * Only available in dense storage
+ */
+const double* TractStore::Column(const size_t col, const size_t target) const {
+  return values_.data() + (target * n_cats_ + col) * n_tracts_;
+}
+
+/*
+ * Adds the values of the columns [first_col, n_cats) of a row to dest, i.e.
+ * dest[col] += value
+ */
+void TractStore::AddRowTo(
+  const size_t row,
+  const size_t target,
+  const size_t first_col,
+  double *dest
+) const {
+  if (storage_ == TractStorage::dense) {
+    for (size_t col = first_col; col < n_cats_; col++) {
+      dest[col] += values_[(target * n_cats_ + col) * n_tracts_ + row];
+    }
+
+    return;
+  }
+
+  size_t key = target * n_tracts_ + row;
+  for (size_t j = sparse_offsets_[key]; j < sparse_offsets_[key + 1]; j++) {
+    if (sparse_cols_[j] >= first_col) {
+      dest[sparse_cols_[j]] += sparse_values_[j];
+    }
+  }
+}
+
+bool TractStore::NonNil(const size_t row, const size_t target) const {
+  return nonnil_[target * n_tracts_ + row] != 0;
+}
+
+size_t TractStore::GetInternalPsu(const size_t row) const {
+  return internal_psus_[row];
+}
+
+/*
+ * The rows [0, LevelEnd(psu)) are the tracts of the psu or any smaller psu
+ */
+size_t TractStore::LevelEnd(const size_t psu) const {
+  return level_ends_[psu];
+}
+
+/*
+ * Fill the TractStore with values from the plots. All variables and domains
+ * are filled in the same pass over the plots. The value of variable var of a
+ * plot in domain d is added to target var * n_domains + d, i.e. the value is 0
+ * in all other domains.
+ *
+ * The plots are first resolved to rows and columns, and then bucketed by row.
+ * The rows are filled in parallel, each row by one thread, adding the plots of
+ * the row in plot order. Thus, the result does not depend on the number of
+ * threads.
  */
 void TractStore::Fill(
-  const Rcpp::DataFrame &data,
+  const PlotData &data,
   const KeyValueMap &categories,
-  const double tract_area
+  const double tract_area,
+  FillDiagnostics &diagnostics
 ) {
-  Rcpp::IntegerVector dt_tract_ids = data[0];
-  Rcpp::IntegerVector dt_cats = data[1];
-  Rcpp::NumericVector dt_weights = data[2];
-  Rcpp::NumericVector dt_values = data[3];
+  size_t n_vars = data.NumVars();
 
-  size_t n_dt = data.nrows();
+  if (n_vars * n_domains_ != n_targets_ || data.NumDomains() != n_domains_) {
+    throw std::range_error("(TractStore::Fill) number of variables or domains does not match");
+  }
+
+  size_t n_dt = data.Size();
 
-  // TractMap::iterator it;
+  // Resolve the tracts of all plots at once
+  std::vector<size_t> rows(n_dt);
+  FindExternalAll(data.tract_ids_, n_dt, rows.data());
 
+  std::vector<size_t> cols(n_dt);
+  std::vector<PlotStatus> status(n_dt, PlotStatus::used);
+
+  #ifdef _OPENMP
+  #pragma omp parallel for num_threads(n_threads_) schedule(static)
+  #endif
   for (size_t i = 0; i < n_dt; i++) {
-    int id = dt_tract_ids[i];
-    int external_cat = dt_cats[i];
-    double weight = dt_weights[i];
-    double value = dt_values[i];
+    if (data.GetDomain(i) >= n_domains_) {
+      status[i] = PlotStatus::bad_domain;
+      continue;
+    }
 
-    if (weight == 0.0 || value == 0.0) {
+    if (data.weights_[i] == 0.0) {
+      status[i] = PlotStatus::nil;
       continue;
     }
 
-    Tract *tract = FindExternal(id);
+    bool all_nil = true;
+    for (size_t var = 0; var < n_vars; var++) {
+      if (data.values_[var][i] != 0.0) {
+        all_nil = false;
+        break;
+      }
+    }
 
-    if (tract == nullptr) {
-      // ERROR -- User input error if tract IDs doesnt exist
-      // Might be OK to input larger data set than needed.
-      Rcpp::warning(
-        std::string("Tract of plot ") + std::to_string(i+1)
-        + std::string(" (") + std::to_string(id)
-        + std::string(") does not exist; plot is ignored")
-        );
+    if (all_nil) {
+      status[i] = PlotStatus::nil;
       continue;
     }
 
-    size_t internal_cat = categories.GetInternalKey(external_cat);
-    size_t plot_psu = categories.GetValue(internal_cat);
+    if (rows[i] == KeyIndex::npos) {
+      status[i] = PlotStatus::missing_tract;
+      continue;
+    }
 
-    if (tract->GetInternalPsu() < plot_psu) {
-      Rcpp::warning(
-        std::string("Category of plot ") + std::to_string(i+1)
-        + std::string(" does not match PSU of tract ") + std::to_string(id)
-        + std::string("; plot is ignored")
-        );
+    size_t internal_cat;
+
+    if (!categories.FindInternalKey(data.cats_[i], &internal_cat)) {
+      status[i] = PlotStatus::bad_category;
+      continue;
+    }
+
+    if (GetInternalPsu(rows[i]) < categories.GetValueUnchecked(internal_cat)) {
+      status[i] = PlotStatus::psu_mismatch;
       continue;
     }
 
-    tract->Add(internal_cat, weight * value / tract_area);
+    cols[i] = cat_columns_[internal_cat];
   }
 
-  return;
+  // Report the issues in plot order, and bucket the used plots by row
+  std::vector<size_t> row_offsets(n_tracts_ + 1, 0);
+
+  for (size_t i = 0; i < n_dt; i++) {
+    switch (status[i]) {
+    case PlotStatus::used:
+      row_offsets[rows[i] + 1] += 1;
+      break;
+    case PlotStatus::bad_domain:
+      throw std::range_error("(TractStore::Fill) domain of plot " + std::to_string(i+1) + " oob");
+    case PlotStatus::bad_category:
+      throw std::range_error(
+        "(TractStore::Fill) category of plot " + std::to_string(i+1)
+        + " (" + std::to_string(data.cats_[i]) + ") not found"
+        );
+    case PlotStatus::missing_tract:
+      // ERROR -- User input error if tract IDs doesnt exist
+      // Might be OK to input larger data set than needed.
+      diagnostics.AddMissingTract(i, data.tract_ids_[i]);
+      break;
+    case PlotStatus::psu_mismatch:
+      diagnostics.AddPsuMismatch(i, data.tract_ids_[i]);
+      break;
+    default:
+      break;
+    }
+  }
+
+  for (size_t row = 0; row < n_tracts_; row++) {
+    row_offsets[row + 1] += row_offsets[row];
+  }
+
+  std::vector<size_t> row_plots(row_offsets[n_tracts_]);
+  std::vector<size_t> row_fill(row_offsets.begin(), row_offsets.end() - 1);
+
+  for (size_t i = 0; i < n_dt; i++) {
+    if (status[i] == PlotStatus::used) {
+      row_plots[row_fill[rows[i]]++] = i;
+    }
+  }
+
+  if (storage_ == TractStorage::dense) {
+    #ifdef _OPENMP
+    #pragma omp parallel for num_threads(n_threads_) schedule(static)
+    #endif
+    for (size_t row = 0; row < n_tracts_; row++) {
+      for (size_t j = row_offsets[row]; j < row_offsets[row + 1]; j++) {
+        size_t i = row_plots[j];
+        size_t domain = data.GetDomain(i);
+        double weight = data.weights_[i];
+
+        for (size_t var = 0; var < n_vars; var++) {
+          double value = data.values_[var][i];
+
+          if (value == 0.0) {
+            continue;
+          }
+
+          Add(row, cols[i], var * n_domains_ + domain, weight * value / tract_area);
+        }
+      }
+    }
 
+    return;
+  }
+
+  // In sparse storage, the cells of each row are first counted, and then
+  // written, once the offsets are known
+  std::vector<size_t> cell_counts(n_targets_ * n_tracts_, 0);
+
+  for (size_t pass = 0; pass < 2; pass++) {
+    #ifdef _OPENMP
+    #pragma omp parallel num_threads(n_threads_)
+    #endif
+    {
+      std::vector<TractCell> cells;
+
+      #ifdef _OPENMP
+      #pragma omp for schedule(static)
+      #endif
+      for (size_t row = 0; row < n_tracts_; row++) {
+        cells.clear();
+
+        for (size_t j = row_offsets[row]; j < row_offsets[row + 1]; j++) {
+          size_t i = row_plots[j];
+          size_t domain = data.GetDomain(i);
+          double weight = data.weights_[i];
+
+          for (size_t var = 0; var < n_vars; var++) {
+            double value = data.values_[var][i];
+
+            if (value == 0.0) {
+              continue;
+            }
+
+            cells.push_back({var * n_domains_ + domain, cols[i], weight * value / tract_area});
+          }
+        }
+
+        // Cells sharing target and column are summed in plot order
+        std::stable_sort(
+          cells.begin(),
+          cells.end(),
+          [](const TractCell &a, const TractCell &b) {
+            return a.target < b.target || (a.target == b.target && a.col < b.col);
+          }
+          );
+
+        size_t cell = 0;
+        for (size_t c = 0; c < cells.size(); c++) {
+          size_t key = cells[c].target * n_tracts_ + row;
+
+          if (c > 0 && cells[c].target == cells[c - 1].target && cells[c].col == cells[c - 1].col) {
+            if (pass == 1) {
+              sparse_values_[sparse_offsets_[key] + cell - 1] += cells[c].value;
+            }
+
+            continue;
+          }
+
+          if (c > 0 && cells[c].target != cells[c - 1].target) {
+            cell = 0;
+          }
+
+          if (pass == 0) {
+            cell_counts[key] += 1;
+          } else {
+            sparse_cols_[sparse_offsets_[key] + cell] = cells[c].col;
+            sparse_values_[sparse_offsets_[key] + cell] = cells[c].value;
+            nonnil_[key] = 1;
+          }
+
+          cell += 1;
+        }
+      }
+    }
+
+    if (pass == 0) {
+      sparse_offsets_.assign(n_targets_ * n_tracts_ + 1, 0);
+
+      for (size_t key = 0; key < n_targets_ * n_tracts_; key++) {
+        sparse_offsets_[key + 1] = sparse_offsets_[key] + cell_counts[key];
+      }
+
+      sparse_cols_.assign(sparse_offsets_.back(), 0);
+      sparse_values_.assign(sparse_offsets_.back(), 0.0);
+    }
+  }
+
+  return;
 }
 
-int TractStore::NonNilTracts() {
-  int ntracts = 0;
+/*
+ * Number of non-nil tracts, per target
+ */
+std::vector<int> TractStore::NonNilTracts() {
+  std::vector<int> ntracts(n_targets_, 0);
 
-  for (size_t i = tract_map_.size(); i --> 0;) {
-    if (tract_map_[i].nonnil_) {
-      ntracts += 1;
+  for (size_t target = 0; target < n_targets_; target++) {
+    for (size_t row = 0; row < n_tracts_; row++) {
+      if (NonNil(row, target)) {
+        ntracts[target] += 1;
+      }
     }
   }
 
   return ntracts;
 }
 
+/*
+ * Number of positive tracts, per target and category, i.e.
+ * ntracts[target * n_cats + cat]
+ */
 std::vector<int> TractStore::PositiveTractsPerCat() {
-  std::vector<int> ntracts(n_cats_, 0);
+  std::vector<int> ntracts(n_targets_ * n_cats_, 0);
+
+  for (size_t target = 0; target < n_targets_; target++) {
+    int *target_ntracts = ntracts.data() + target * n_cats_;
 
-  for (size_t i = tract_map_.size(); i --> 0;) {
-    for (size_t j = 0; j < n_cats_; j++) {
-      if (tract_map_[i].Get(j) > 0.0) {
-        ntracts[j] += 1;
+    if (storage_ == TractStorage::sparse) {
+      size_t first = sparse_offsets_[target * n_tracts_];
+      size_t last = sparse_offsets_[(target + 1) * n_tracts_];
+
+      for (size_t j = first; j < last; j++) {
+        if (sparse_values_[j] > 0.0) {
+          target_ntracts[cat_order_[sparse_cols_[j]]] += 1;
+        }
       }
+
+      continue;
+    }
+
+    for (size_t col = 0; col < n_cats_; col++) {
+      const double *x = Column(col, target);
+      int n = 0;
+
+      for (size_t row = 0; row < n_tracts_; row++) {
+        if (x[row] > 0.0) {
+          n += 1;
+        }
+      }
+
+      target_ntracts[cat_order_[col]] = n;
     }
   }
 
@@ -190,32 +650,44 @@ std::vector<int> TractStore::PositiveTractsPerCat() {
 }
 
 /*
- * Sum up the tracts, i.e. return the sum of the tract means per area unit
+ * Sum up the tracts, i.e. return the sum of the tract means per area unit.
+ * Estimates are returned per target, i.e. sums[target * n_cats + cat]
  */
 std::vector<double> TractStore::CatEstimates(
   const KeyValueMap &psus,
   const KeyValueMap &categories,
   const double area
 ) {
-  std::vector<double> sums(n_cats_, 0.0);
+  std::vector<double> sums(n_targets_ * n_cats_, 0.0);
+  std::vector<double> col_sums(n_cats_);
 
-  for (size_t i = tract_map_.size(); i --> 0;) {
-    Tract *tract = &tract_map_[i];
-    if (!tract->nonnil_) {
-      continue;
-    }
+  for (size_t target = 0; target < n_targets_; target++) {
+    std::fill(col_sums.begin(), col_sums.end(), 0.0);
+
+    if (storage_ == TractStorage::sparse) {
+      for (size_t row = 0; row < n_tracts_; row++) {
+        AddRowTo(row, target, 0, col_sums.data());
+      }
+    } else {
+      for (size_t col = 0; col < n_cats_; col++) {
+        const double *x = Column(col, target);
 
-    for (size_t k = 0; k < n_cats_; k++) {
-      sums[k] += tract->Get(k);
+        for (size_t row = 0; row < n_tracts_; row++) {
+          col_sums[col] += x[row];
+        }
+      }
     }
-  }
 
-  for (size_t k = 0; k < n_cats_; k++) {
-    size_t psu_n = psus.GetValue(categories.GetValue(k));
-    if (psu_n > 0) {
-      sums[k] *= area / (double)psu_n;
-    } else {
-      sums[k] = std::numeric_limits<double>::quiet_NaN();
+    for (size_t col = 0; col < n_cats_; col++) {
+      size_t cat = cat_order_[col];
+      double sum = col_sums[col];
+
+      size_t psu_n = psus.GetValue(categories.GetValue(cat));
+      if (psu_n > 0) {
+        sums[target * n_cats_ + cat] = sum * (area / (double)psu_n);
+      } else {
+        sums[target * n_cats_ + cat] = std::numeric_limits<double>::quiet_NaN();
+      }
     }
   }
 
@@ -223,65 +695,213 @@ std::vector<double> TractStore::CatEstimates(
 }
 
 /*
- * Calculate covariances for the categories. Returns an upper triangular
- * covariance matrix.
+ * Calculate covariances for the categories. Returns one symmetric covariance
+ * matrix per target, i.e. covs[target * n_cats * n_cats + cat_k * n_cats + cat_l]
  */
 std::vector<double> TractStore::Variance(
   const KeyValueMap &psus,
   const KeyValueMap &categories,
   const double area
 ) {
-  std::vector<double> sums(n_cats_, 0.0);
-  std::vector<bool> all_nils(n_cats_, true);
-  std::vector<double> covs(n_cats_ * n_cats_, 0.0);
-
-  std::vector<size_t> sorted_cats; sorted_cats.reserve(n_cats_);
-  std::vector<size_t> ids; ids.reserve(Size());
-  for (size_t cat = 0; cat < n_cats_; cat++) sorted_cats.push_back(cat);
-
-  std::sort(
-    sorted_cats.begin(),
-    sorted_cats.end(),
-    [&categories](size_t a, size_t b) { return categories.GetValue(a) > categories.GetValue(b); }
-    );
-  size_t first_cat = 0;
+  if (storage_ == TractStorage::sparse) {
+    return VarianceSparse(psus, categories, area);
+  }
 
-  // We will loop through all psu's, and create a list of tracts belonging to
-  // each psu. If the loop goes from smallest to largest, we only need to append
-  // units to the list as we increase the psu.
+  const size_t col_tile = 32;
+  const size_t row_tile = 256;
+  size_t n_cells = n_cats_ * n_cats_;
+  std::vector<double> means(n_targets_ * n_cats_, 0.0); // Per target and column
+  std::vector<double> comoments(n_targets_ * n_cells, 0.0); // Per target, [col_k * n_cats + col_l]
+  std::vector<unsigned char> all_nils(n_targets_ * n_cats_, 1); // Per target and column
+  std::vector<double> covs(n_targets_ * n_cells, 0.0);
+
+  std::vector<double> block_means(n_targets_ * n_cats_); // Per target and column
+  std::vector<double> block_comoments(n_targets_ * n_cells); // As comoments
+  std::vector<std::vector<size_t>> block_cols(n_targets_); // Per target, the non-nil columns
+  std::vector<double> centred; // Per target, the centred non-nil columns of the block
+  std::vector<size_t> centred_offsets(n_targets_ + 1, 0);
+  std::vector<std::array<size_t, 3>> tasks; // (target, tile_k, tile_l)
+
+  size_t row = 0;
+  size_t first_col = 0;
+  size_t last_col = 0;
+
+  // We will loop through all psu's, from smallest to largest. As the rows are
+  // ordered by psu, each psu adds a block of rows to the sample of the smaller
+  // psu's.
   //
-  // For each psu, we will check all pairs of categories to see if any pair
-  // matches the condition of (l, m) being a pair where either l is part of the
-  // current psu, and m is part of a larger psu, or vice verse.
+  // For each psu, the covariances are needed for all pairs of categories (k, l)
+  // where k is part of the current psu, and l is part of the current or a
+  // larger psu.
   // (However, the order is reversed; a small psu-value indicates a larger sample)
   //
-  // If a pair matches this criterion, we will calculate the covariance.
+  // Thus, we keep running means and co-moments of all columns of the current
+  // or larger psu's. The co-moments of each new block of rows are computed
+  // once, and merged with the running co-moments by
+  //   M_AB = M_A + M_B + d_k * d_l * n_A * n_B / (n_A + n_B),
+  // where d is the difference of the means of the block and of the sample.
 
   // Go smallest -> largest psu
   for (size_t psu = psus.Size(); psu --> 0;) {
-    // Prepare ids
-    for (size_t i = Size(); i --> 0;) {
-      Tract *tract = FindInternal(i);
-      // Any other tract w/ smaller psu have already been added
-      if (tract->GetInternalPsu() != psu) {
-        continue;
+    size_t block_start = row;
+    row = LevelEnd(psu);
+
+    // The categories of the current psu are the columns [first_col, last_col)
+    first_col = last_col;
+    for (; last_col < n_cats_; last_col++) {
+      if (categories.GetValue(cat_order_[last_col]) < psu) {
+        break;
+      }
+    }
+
+    double n_a = (double)block_start;
+    double n_b = (double)(row - block_start);
+    double n_ab = n_a + n_b;
+
+    // A psu without tracts of its own leaves the sample unchanged
+    if (row > block_start) {
+      size_t n_block = row - block_start;
+
+      // Block means, and the columns which are non-nil in the block
+      #ifdef _OPENMP
+      #pragma omp parallel for num_threads(n_threads_) schedule(static)
+      #endif
+      for (size_t target = 0; target < n_targets_; target++) {
+        size_t target_offset = target * n_cats_;
+        block_cols[target].clear();
+
+        for (size_t col = first_col; col < n_cats_; col++) {
+          const double *x = Column(col, target);
+          double sum = 0.0;
+          bool nil = true;
+
+          for (size_t i = block_start; i < row; i++) {
+            sum += x[i];
+
+            if (x[i] != 0.0) {
+              nil = false;
+            }
+          }
+
+          block_means[target_offset + col] = sum / n_b;
+
+          if (!nil) {
+            block_cols[target].push_back(col);
+            all_nils[target_offset + col] = 0;
+          }
+        }
+      }
+
+      // Centre the non-nil columns of the block
+      for (size_t target = 0; target < n_targets_; target++) {
+        centred_offsets[target + 1] = centred_offsets[target] + block_cols[target].size() * n_block;
       }
 
-      ids.push_back(i);
+      centred.resize(centred_offsets[n_targets_]);
+
+      #ifdef _OPENMP
+      #pragma omp parallel for num_threads(n_threads_) schedule(static)
+      #endif
+      for (size_t target = 0; target < n_targets_; target++) {
+        for (size_t k = 0; k < block_cols[target].size(); k++) {
+          size_t col = block_cols[target][k];
+          const double *x = Column(col, target) + block_start;
+          double mean = block_means[target * n_cats_ + col];
+          double *z = centred.data() + centred_offsets[target] + k * n_block;
 
-      if (!tract->nonnil_) {
-        continue;
+          for (size_t i = 0; i < n_block; i++) {
+            z[i] = x[i] - mean;
+          }
+        }
       }
 
-      for (size_t cat = 0; cat < n_cats_; cat++) {
-        if (tract->Get(cat) == 0.0) {
-          continue;
+      // The block co-moments of the non-nil columns, as a symmetric product of
+      // the centred block with itself. The columns are split into tiles, and
+      // each pair of tiles is computed by one thread, over tiles of rows.
+      tasks.clear();
+      for (size_t target = 0; target < n_targets_; target++) {
+        size_t n_tiles = (block_cols[target].size() + col_tile - 1) / col_tile;
+
+        for (size_t tile_k = 0; tile_k < n_tiles; tile_k++) {
+          for (size_t tile_l = tile_k; tile_l < n_tiles; tile_l++) {
+            tasks.push_back({target, tile_k, tile_l});
+          }
         }
+      }
+
+      #ifdef _OPENMP
+      #pragma omp parallel for num_threads(n_threads_) schedule(dynamic, 1)
+      #endif
+      for (size_t t = 0; t < tasks.size(); t++) {
+        size_t target = tasks[t][0];
+        const std::vector<size_t> &cols = block_cols[target];
+        const double *z = centred.data() + centred_offsets[target];
+        double *target_block = block_comoments.data() + target * n_cells;
+        size_t k_start = tasks[t][1] * col_tile;
+        size_t k_end = std::min(k_start + col_tile, cols.size());
+        size_t l_start = tasks[t][2] * col_tile;
+        size_t l_end = std::min(l_start + col_tile, cols.size());
+
+        for (size_t k = k_start; k < k_end; k++) {
+          for (size_t l = std::max(k, l_start); l < l_end; l++) {
+            target_block[cols[k] * n_cats_ + cols[l]] = 0.0;
+          }
+        }
+
+        for (size_t i_start = 0; i_start < n_block; i_start += row_tile) {
+          size_t i_end = std::min(i_start + row_tile, n_block);
+
+          for (size_t k = k_start; k < k_end; k++) {
+            const double *z_k = z + k * n_block;
+
+            for (size_t l = std::max(k, l_start); l < l_end; l++) {
+              const double *z_l = z + l * n_block;
+              double comoment = 0.0;
+
+              for (size_t i = i_start; i < i_end; i++) {
+                comoment += z_k[i] * z_l[i];
+              }
+
+              target_block[cols[k] * n_cats_ + cols[l]] += comoment;
+            }
+          }
+        }
+      }
+
+      // Merge the block into the sample
+      #ifdef _OPENMP
+      #pragma omp parallel for num_threads(n_threads_) schedule(static)
+      #endif
+      for (size_t target = 0; target < n_targets_; target++) {
+        double *target_means = means.data() + target * n_cats_;
+        double *target_comoments = comoments.data() + target * n_cells;
+        const double *target_block_means = block_means.data() + target * n_cats_;
+        const double *target_block = block_comoments.data() + target * n_cells;
+        const std::vector<size_t> &cols = block_cols[target];
+
+        // If all block units are 0, the block co-moment is 0
+        for (size_t k = 0; k < cols.size(); k++) {
+          for (size_t l = k; l < cols.size(); l++) {
+            size_t cell = cols[k] * n_cats_ + cols[l];
+            target_comoments[cell] += target_block[cell];
+          }
+        }
+
+        for (size_t col_k = first_col; col_k < n_cats_; col_k++) {
+          double delta_k = target_block_means[col_k] - target_means[col_k];
 
-        sums[cat] += tract->Get(cat);
+          if (delta_k == 0.0) {
+            continue;
+          }
+
+          for (size_t col_l = col_k; col_l < n_cats_; col_l++) {
+            double delta_l = target_block_means[col_l] - target_means[col_l];
+            target_comoments[col_k * n_cats_ + col_l] += delta_k * delta_l * n_a * n_b / n_ab;
+          }
+        }
 
-        if (all_nils[cat]) {
-          all_nils[cat] = false;
+        for (size_t col = first_col; col < n_cats_; col++) {
+          target_means[col] += (target_block_means[col] - target_means[col]) * n_b / n_ab;
         }
       }
     }
@@ -289,73 +909,292 @@ std::vector<double> TractStore::Variance(
     double psu_size = (double)psus.GetValue(psu);
 
     if (psu_size <= 1.0) {
-      for (size_t cat_ki = first_cat; cat_ki < n_cats_; cat_ki++) {
-        size_t cat_k = sorted_cats[cat_ki];
+      for (size_t target = 0; target < n_targets_; target++) {
+        double *target_covs = covs.data() + target * n_cells;
 
-        if (categories.GetValue(cat_k) < psu) {
-          first_cat = cat_ki;
-          break;
-        }
+        for (size_t col_k = first_col; col_k < last_col; col_k++) {
+          size_t cat_k = cat_order_[col_k];
 
-        covs[cat_k * (n_cats_ + 1)] = std::numeric_limits<double>::quiet_NaN();
+          target_covs[cat_k * (n_cats_ + 1)] = std::numeric_limits<double>::quiet_NaN();
 
-        for (size_t cat_li = cat_ki + 1; cat_li < n_cats_; cat_li++) {
-          size_t cat_l = sorted_cats[cat_li];
-          covs[cat_k * n_cats_ + cat_l] = std::numeric_limits<double>::quiet_NaN();
-          covs[cat_l * n_cats_ + cat_k] = std::numeric_limits<double>::quiet_NaN();
+          for (size_t col_l = col_k + 1; col_l < n_cats_; col_l++) {
+            size_t cat_l = cat_order_[col_l];
+            target_covs[cat_k * n_cats_ + cat_l] = std::numeric_limits<double>::quiet_NaN();
+            target_covs[cat_l * n_cats_ + cat_k] = std::numeric_limits<double>::quiet_NaN();
+          }
         }
       }
 
       continue;
     }
 
-    // Each pair of categories from at least this, or larger, PSU, should be
-    // calcualted
-    // Outer loop of smaller (current PSU)
-    // Inner loop of larger
-    for (size_t cat_ki = first_cat; cat_ki < n_cats_; cat_ki++) {
-      size_t cat_k = sorted_cats[cat_ki];
+    for (size_t target = 0; target < n_targets_; target++) {
+      double *target_covs = covs.data() + target * n_cells;
+      const double *target_comoments = comoments.data() + target * n_cells;
+      size_t target_offset = target * n_cats_;
+
+      for (size_t col_k = first_col; col_k < last_col; col_k++) {
+        // If all current units are 0, the covariance of any category l is 0
+        if (all_nils[target_offset + col_k]) {
+          continue;
+        }
 
-      // We don't need to go further than this
-      if (categories.GetValue(cat_k) < psu) {
-        first_cat = cat_ki;
+        size_t cat_k = cat_order_[col_k];
+
+        for (size_t col_l = col_k; col_l < n_cats_; col_l++) {
+          // If all current units are 0, the covariance of any category l is 0
+          if (all_nils[target_offset + col_l]) {
+            continue;
+          }
+
+          size_t cat_l = cat_order_[col_l];
+          size_t psu_larger = categories.GetValueUnchecked(cat_l);
+          double psu_size_larger = (double)psus.GetValueUnchecked(psu_larger);
+          double cov = target_comoments[col_k * n_cats_ + col_l]
+            * (area / psu_size) * (area / psu_size_larger)
+            * (psu_size / (psu_size - 1.0));
+
+          // Upper triangular id
+          target_covs[cat_k * n_cats_ + cat_l] = cov;
+
+          if (cat_k != cat_l) {
+            target_covs[cat_l * n_cats_ + cat_k] = cov;
+          }
+        }
+      }
+    }
+  }
+
+  return covs;
+}
+
+/*
+ * Calculate covariances for the categories from the sparse storage, as
+ * Variance: each PSU adds a block of rows to the sample, whose co-moments
+ * around the block means are merged with the running co-moments.
+ *
+ * The block co-moments are computed from the non-zero cells of the block only.
+ * With z = x - m for the block mean m of each column, a zero cell is z = -m.
+ * Splitting the rows by which of the columns k and l are non-zero gives
+ *   M_kl = D_kl - m_l (A_k - B_kl) - m_k (A_l - B_lk) + m_k m_l (n - n_k - n_l + n_kl),
+ * where, over the non-zero cells, A_k is the sum of z_k and n_k the count, and,
+ * over the rows where both k and l are non-zero, D_kl is the sum of z_k z_l,
+ * B_kl the sum of z_k, and n_kl the count. All terms are centred, so no
+ * precision is lost to large means. Only the active columns, i.e. those with
+ * at least one non-zero cell, are visited. Returns the covariances as Variance.
+ */
+std::vector<double> TractStore::VarianceSparse(
+  const KeyValueMap &psus,
+  const KeyValueMap &categories,
+  const double area
+) {
+  size_t n_cells = n_cats_ * n_cats_;
+  std::vector<double> means(n_targets_ * n_cats_, 0.0); // Per target and column
+  std::vector<double> comoments(n_targets_ * n_cells, 0.0); // Per target, [col_k * n_cats + col_l]
+  std::vector<bool> active(n_targets_ * n_cats_, false); // Per target and column
+  std::vector<std::vector<size_t>> active_cols(n_targets_);
+  std::vector<double> covs(n_targets_ * n_cells, 0.0);
+
+  // The sums of one target over the block, see above
+  std::vector<double> block_means(n_cats_, 0.0);
+  std::vector<double> block_sums(n_cats_, 0.0); // A
+  std::vector<size_t> block_counts(n_cats_, 0); // n_k
+  std::vector<double> block_products(n_cells, 0.0); // D
+  std::vector<double> block_partials(n_cells, 0.0); // B
+  std::vector<size_t> block_pairs(n_cells, 0); // n_kl
+  std::vector<bool> block_active(n_cats_, false);
+  std::vector<size_t> block_cols;
+
+  size_t row = 0;
+  size_t first_col = 0;
+  size_t last_col = 0;
+
+  // Go smallest -> largest psu
+  for (size_t psu = psus.Size(); psu --> 0;) {
+    size_t block_start = row;
+    row = LevelEnd(psu);
+
+    // The categories of the current psu are the columns [first_col, last_col)
+    first_col = last_col;
+    for (; last_col < n_cats_; last_col++) {
+      if (categories.GetValue(cat_order_[last_col]) < psu) {
         break;
       }
+    }
 
-      // If all current units are 0, the covariance of any category l is 0
-      if (all_nils[cat_k]) {
-        continue;
+    double n_a = (double)block_start;
+    double n_b = (double)(row - block_start);
+    double n_ab = n_a + n_b;
+
+    // A psu without tracts of its own leaves the sample unchanged
+    for (size_t target = 0; row > block_start && target < n_targets_; target++) {
+      const size_t *offsets = sparse_offsets_.data() + target * n_tracts_;
+      double *target_means = means.data() + target * n_cats_;
+      double *target_comoments = comoments.data() + target * n_cells;
+
+      // Block means, and the columns which are non-zero in the block
+      block_cols.clear();
+      for (size_t j = offsets[block_start]; j < offsets[row]; j++) {
+        size_t col = sparse_cols_[j];
+        block_means[col] += sparse_values_[j];
+
+        if (!block_active[col]) {
+          block_active[col] = true;
+          block_cols.push_back(col);
+        }
       }
 
-      double mean_k = sums[cat_k] / psu_size;
+      std::sort(block_cols.begin(), block_cols.end());
+
+      for (size_t col : block_cols) {
+        block_means[col] /= n_b;
+      }
 
-      for (size_t cat_li = cat_ki; cat_li < n_cats_; cat_li++) {
-        size_t cat_l = sorted_cats[cat_li];
+      // The centred sums over the non-zero cells. The cells of a row are
+      // ordered by column, thus col_l >= col_k
+      for (size_t i = block_start; i < row; i++) {
+        for (size_t j = offsets[i]; j < offsets[i + 1]; j++) {
+          size_t col_k = sparse_cols_[j];
+          double z_k = sparse_values_[j] - block_means[col_k];
 
-        // If all current units are 0, the covariance of any category l is 0
-        if (all_nils[cat_l]) {
+          block_sums[col_k] += z_k;
+          block_counts[col_k] += 1;
+
+          for (size_t jj = j; jj < offsets[i + 1]; jj++) {
+            size_t col_l = sparse_cols_[jj];
+            double z_l = sparse_values_[jj] - block_means[col_l];
+
+            block_products[col_k * n_cats_ + col_l] += z_k * z_l;
+            block_partials[col_k * n_cats_ + col_l] += z_k;
+            block_pairs[col_k * n_cats_ + col_l] += 1;
+
+            if (col_l != col_k) {
+              block_partials[col_l * n_cats_ + col_k] += z_l;
+            }
+          }
+        }
+      }
+
+      // Merge the block co-moments into the sample
+      for (size_t a = 0; a < block_cols.size(); a++) {
+        size_t col_k = block_cols[a];
+
+        for (size_t b = a; b < block_cols.size(); b++) {
+          size_t col_l = block_cols[b];
+          size_t cell = col_k * n_cats_ + col_l;
+          double m_k = block_means[col_k];
+          double m_l = block_means[col_l];
+          double n_zeros = n_b - (double)block_counts[col_k] - (double)block_counts[col_l]
+            + (double)block_pairs[cell];
+
+          target_comoments[cell] += block_products[cell]
+            - m_l * (block_sums[col_k] - block_partials[cell])
+            - m_k * (block_sums[col_l] - block_partials[col_l * n_cats_ + col_k])
+            + m_k * m_l * n_zeros;
+
+          block_products[cell] = 0.0;
+          block_partials[cell] = 0.0;
+          block_partials[col_l * n_cats_ + col_k] = 0.0;
+          block_pairs[cell] = 0;
+        }
+      }
+
+      for (size_t col : block_cols) {
+        if (!active[target * n_cats_ + col]) {
+          active[target * n_cats_ + col] = true;
+          active_cols[target].push_back(col);
+        }
+      }
+
+      std::vector<size_t> &cols = active_cols[target];
+      std::sort(cols.begin(), cols.end());
+
+      // Merge the means, over the active columns of the current or larger psus.
+      // The other columns are 0 in both the block and the sample.
+      for (size_t a = 0; a < cols.size(); a++) {
+        size_t col_k = cols[a];
+        double delta_k = block_means[col_k] - target_means[col_k];
+
+        if (col_k < first_col || delta_k == 0.0) {
           continue;
         }
 
-        // Upper triangular id
-        size_t covs_index = cat_k * n_cats_ + cat_l;
-        double mean_l = sums[cat_l] / psu_size;
+        for (size_t b = a; b < cols.size(); b++) {
+          size_t col_l = cols[b];
+          double delta_l = block_means[col_l] - target_means[col_l];
+          target_comoments[col_k * n_cats_ + col_l] += delta_k * delta_l * n_a * n_b / n_ab;
+        }
+      }
+
+      for (size_t col : cols) {
+        if (col >= first_col) {
+          target_means[col] += (block_means[col] - target_means[col]) * n_b / n_ab;
+        }
+      }
+
+      for (size_t col : block_cols) {
+        block_means[col] = 0.0;
+        block_sums[col] = 0.0;
+        block_counts[col] = 0;
+        block_active[col] = false;
+      }
+    }
+
+    double psu_size = (double)psus.GetValue(psu);
+
+    if (psu_size <= 1.0) {
+      for (size_t target = 0; target < n_targets_; target++) {
+        double *target_covs = covs.data() + target * n_cells;
 
-        for (size_t i = ids.size(); i --> 0;) {
-          Tract *tract = FindInternal(ids[i]);
-          covs[covs_index] += (tract->Get(cat_k) - mean_k)
-            * (tract->Get(cat_l) - mean_l);
+        for (size_t col_k = first_col; col_k < last_col; col_k++) {
+          size_t cat_k = cat_order_[col_k];
+
+          target_covs[cat_k * (n_cats_ + 1)] = std::numeric_limits<double>::quiet_NaN();
+
+          for (size_t col_l = col_k + 1; col_l < n_cats_; col_l++) {
+            size_t cat_l = cat_order_[col_l];
+            target_covs[cat_k * n_cats_ + cat_l] = std::numeric_limits<double>::quiet_NaN();
+            target_covs[cat_l * n_cats_ + cat_k] = std::numeric_limits<double>::quiet_NaN();
+          }
         }
+      }
+
+      continue;
+    }
 
-        size_t psu_larger = categories.GetValue(cat_l);
-        double psu_size_larger = (double)psus.GetValue(psu_larger);
-        covs[covs_index] *= (area / psu_size) * (area / psu_size_larger)
-          * (psu_size / (psu_size - 1.0));
+    for (size_t target = 0; target < n_targets_; target++) {
+      double *target_covs = covs.data() + target * n_cells;
+      const double *target_comoments = comoments.data() + target * n_cells;
+      const std::vector<size_t> &cols = active_cols[target];
 
-        if (cat_k != cat_l) {
-          covs[cat_l * n_cats_ + cat_k] = covs[covs_index];
+      // Columns which are not active have covariance 0 with all columns
+      for (size_t a = 0; a < cols.size(); a++) {
+        size_t col_k = cols[a];
+
+        if (col_k < first_col) {
+          continue;
+        } else if (col_k >= last_col) {
+          break;
         }
 
+        size_t cat_k = cat_order_[col_k];
+
+        for (size_t b = a; b < cols.size(); b++) {
+          size_t col_l = cols[b];
+          size_t cat_l = cat_order_[col_l];
+          size_t psu_larger = categories.GetValueUnchecked(cat_l);
+          double psu_size_larger = (double)psus.GetValueUnchecked(psu_larger);
+          double cov = target_comoments[col_k * n_cats_ + col_l]
+            * (area / psu_size) * (area / psu_size_larger)
+            * (psu_size / (psu_size - 1.0));
+
+          // Upper triangular id
+          target_covs[cat_k * n_cats_ + cat_l] = cov;
+
+          if (cat_k != cat_l) {
+            target_covs[cat_l * n_cats_ + cat_k] = cov;
+          }
+        }
       }
     }
   }
@@ -363,52 +1202,228 @@ std::vector<double> TractStore::Variance(
   return covs;
 }
 
-std::vector<double> TractStore::VarianceBalanced(
+/*
+ * Find the neighbourhoods of the tracts of each level, for the local mean
+ * covariances of VarianceBalanced. Returns the neighbourhoods per internal psu;
+ * levels without categories of their own, or with at most one tract, are not
+ * searched. The neighbourhoods only depend on the tracts and the balancing
+ * variables, and can thus be shared by any number of targets.
+ *
+ * One tree is built over all tracts, with the level of each tract, and the
+ * neighbourhoods of all tracts of a level are found in one batch search,
+ * restricted to the tracts of the level, i.e. of the current psu and all
+ * smaller psus.
+ *
+ * The tree uses the bucket size and split method of search. A bucket size of
+ * 0, or a split method of -1, is chosen by KDFlatTree::Calibrate. If set in
+ * search, or automatically for at most 3 balancing variables, a KDGrid is used
+ * instead of the tree. The automatic grid is dropped if the tracts are too
+ * clustered for its cells. A KDBallTree is only used if set in search. The
+ * searches are approximate if search.eps_ > 0 or search.max_leaves_ > 0, see
+ * KDLeafIndex::SetApproximation. As the neighbours then depend on the index,
+ * the grid is not chosen automatically for approximate searches, and the tree
+ * is not calibrated: an unset bucket size is 30, and an unset split method is
+ * midpoint slide. The visited nodes and leaves of all levels are summed in
+ * search.
+ */
+std::vector<KDNeighbours> TractStore::FindBalancedNeighbours(
   const KeyValueMap &psus,
   const KeyValueMap &categories,
-  const double area,
   double *xbalance,
   const size_t p_xbalance,
-  const KeyValueMap &neighbours
-) {
-  std::vector<double> means(n_cats_, 0.0);
-  std::vector<bool> all_nils(n_cats_, true);
-  std::vector<double> covs(n_cats_ * n_cats_, 0.0);
+  const KeyValueMap &neighbours,
+  NeighbourSearch &search
+) const {
+  const size_t grid_mean_size = 8;
+  std::vector<KDNeighbours> level_neighbours(psus.Size());
+
+  // The balancing data, in the row order of the tracts
+  std::vector<double> xrows(Size() * p_xbalance);
+  for (size_t row = 0; row < Size(); row++) {
+    std::copy(
+      xbalance + input_rows_[row] * p_xbalance,
+      xbalance + (input_rows_[row] + 1) * p_xbalance,
+      xrows.begin() + row * p_xbalance
+      );
+  }
 
-  std::vector<size_t> sorted_cats; sorted_cats.reserve(n_cats_);
-  std::vector<size_t> ids; ids.reserve(Size());
-  for (size_t cat = 0; cat < n_cats_; cat++) sorted_cats.push_back(cat);
+  // The level of a row in the tree, smallest psu first. The rows of the level
+  // of psu are then the rows of tree level at most psus.Size() - 1 - psu.
+  std::vector<size_t> tree_levels(Size());
+  for (size_t row = 0; row < Size(); row++) {
+    tree_levels[row] = psus.Size() - 1 - internal_psus_[row];
+  }
 
-  std::sort(
-    sorted_cats.begin(),
-    sorted_cats.end(),
-    [&categories](size_t a, size_t b) { return categories.GetValue(a) > categories.GetValue(b); }
-    );
-  size_t first_cat = 0;
-  size_t last_cat = 0;
+  std::unique_ptr<KDGrid> grid;
+  std::unique_ptr<KDBallTree> ball_tree;
+  std::unique_ptr<KDFlatTree> tree;
 
-  KDStore *store = new KDStore(Size(), neighbours.GetValue(0));
+  bool approximate = search.eps_ > 0.0 || search.max_leaves_ > 0;
+
+  if (search.index_ == (int)NeighbourIndex::grid
+      || (search.index_ < 0 && !approximate && p_xbalance <= KDGrid::maxDimensions)) {
+    grid.reset(new KDGrid(xrows.data(), Size(), p_xbalance, grid_mean_size, tree_levels.data()));
+
+    if (search.index_ < 0 && grid->MeanOccupancy() > 4.0 * (double)grid_mean_size) {
+      grid.reset();
+    }
+  }
+
+  if (grid) {
+    grid->SetApproximation(search.eps_, search.max_leaves_);
+    search.used_index_ = NeighbourIndex::grid;
+  } else {
+    size_t tree_bucket_size = search.bucket_size_ > 0 ? search.bucket_size_ : 30;
+    KDTreeSplitMethod tree_method = search.split_method_ >= 0
+      ? IntToKDTreeSplitMethod(search.split_method_)
+      : KDTreeSplitMethod::midpointSlide;
+
+    // The calibration is timed, and thus only used if it cannot affect the
+    // neighbours found
+    if (!approximate) {
+      KDFlatTree::Calibrate(
+        xrows.data(),
+        Size(),
+        p_xbalance,
+        neighbours.GetValue(0),
+        &tree_bucket_size,
+        &tree_method,
+        search.bucket_size_ == 0,
+        search.split_method_ < 0
+        );
+    }
+
+    if (search.index_ == (int)NeighbourIndex::ballTree) {
+      ball_tree.reset(new KDBallTree(
+        xrows.data(),
+        Size(),
+        p_xbalance,
+        tree_bucket_size,
+        tree_levels.data()
+        ));
+      ball_tree->SetApproximation(search.eps_, search.max_leaves_);
+      search.used_index_ = NeighbourIndex::ballTree;
+    } else {
+      tree.reset(new KDFlatTree(
+        xrows.data(),
+        Size(),
+        p_xbalance,
+        tree_bucket_size,
+        tree_method,
+        tree_levels.data(),
+        n_threads_
+        ));
+      tree->SetApproximation(search.eps_, search.max_leaves_);
+      search.used_index_ = NeighbourIndex::kdTree;
+    }
+  }
+
+  search.n_searches_ = 0;
+  search.n_visited_nodes_ = 0;
+  search.n_visited_leaves_ = 0;
+
+  // Go smallest -> largest psu, as VarianceBalanced
+  size_t first_col = 0;
+  size_t last_col = 0;
 
-  // Go smallest -> largest psu
   for (size_t psu = psus.Size(); psu --> 0;) {
-    if (psus.Size() > 0) {
-      // Prepare ids
-      for (size_t i = Size(); i --> 0;) {
-        Tract *tract = FindInternal(i);
-        // Any other tract w/ smaller psu have already been added
-        if (tract->GetInternalPsu() != psu) {
-          continue;
-        }
+    first_col = last_col;
+    for (; last_col < n_cats_; last_col++) {
+      if (categories.GetValue(cat_order_[last_col]) < psu) {
+        break;
+      }
+    }
+
+    if (psus.GetValue(psu) <= 1 || first_col == last_col || LevelEnd(psu) == 0) {
+      continue;
+    }
 
-        ids.push_back(i);
+    KDNeighbours &neighbours_psu = level_neighbours[psu];
 
-        if (!tract->nonnil_) {
+    if (grid) {
+      grid->FindAllNeighbours(
+        &neighbours_psu,
+        neighbours.GetValue(psu),
+        psus.Size() - 1 - psu,
+        n_threads_
+        );
+    } else if (ball_tree) {
+      ball_tree->FindAllNeighbours(
+        &neighbours_psu,
+        neighbours.GetValue(psu),
+        psus.Size() - 1 - psu,
+        n_threads_
+        );
+    } else {
+      tree->FindAllNeighbours(
+        &neighbours_psu,
+        neighbours.GetValue(psu),
+        psus.Size() - 1 - psu,
+        n_threads_
+        );
+    }
+
+    search.n_searches_ += LevelEnd(psu);
+    search.n_visited_nodes_ += neighbours_psu.visitedNodes;
+    search.n_visited_leaves_ += neighbours_psu.visitedLeaves;
+  }
+
+  return level_neighbours;
+}
+
+/*
+ * Calculate local mean covariances for the categories, using the
+ * neighbourhoods of FindBalancedNeighbours. Returns one symmetric covariance
+ * matrix per target, as Variance.
+ *
+ * The tracts of each level are split into at most 4 chunks per thread, and the
+ * chunks of all levels are processed in parallel, each into its own
+ * accumulator. The accumulators of a level are reduced in chunk order, thus the
+ * result does not depend on the scheduling of the threads. As the chunks only
+ * depend on the number of threads, so does the rounding of the result.
+ */
+std::vector<double> TractStore::VarianceBalanced(
+  const KeyValueMap &psus,
+  const KeyValueMap &categories,
+  const double area,
+  const std::vector<KDNeighbours> &level_neighbours,
+  const KeyValueMap &neighbours
+) {
+  const size_t max_chunks = 4 * n_threads_;
+  size_t n_cells = n_cats_ * n_cats_;
+  std::vector<unsigned char> all_nils(n_targets_ * n_cats_, 1); // Per target and column
+  std::vector<double> values(n_cats_, 0.0);
+  std::vector<double> covs(n_targets_ * n_cells, 0.0);
+
+  if (level_neighbours.size() != psus.Size()) {
+    throw std::range_error("(TractStore::VarianceBalanced) level_neighbours.size != psus.size");
+  }
+
+  // The rows of the current psu and all smaller psus are [0, n_ids)
+  size_t n_ids = 0;
+  size_t first_col = 0;
+  size_t last_col = 0;
+
+  std::vector<BalancedLevel> levels;
+  levels.reserve(psus.Size());
+
+  // Go smallest -> largest psu, and prepare the levels
+  for (size_t psu = psus.Size(); psu --> 0;) {
+    // Add the rows of the current psu
+    for (; n_ids < LevelEnd(psu); n_ids++) {
+      size_t row = n_ids;
+
+      for (size_t target = 0; target < n_targets_; target++) {
+        if (!NonNil(row, target)) {
           continue;
         }
 
-        for (size_t cat = 0; cat < n_cats_; cat++) {
-          if (all_nils[cat] && tract->Get(cat) != 0.0) {
-            all_nils[cat] = false;
+        std::fill(values.begin(), values.end(), 0.0);
+        AddRowTo(row, target, 0, values.data());
+
+        for (size_t col = 0; col < n_cats_; col++) {
+          if (values[col] != 0.0) {
+            all_nils[target * n_cats_ + col] = 0;
           }
         }
       }
@@ -416,118 +1431,172 @@ std::vector<double> TractStore::VarianceBalanced(
 
     double psu_size = (double)psus.GetValue(psu);
 
-    first_cat = last_cat;
-    for (; last_cat < n_cats_; last_cat++) {
-        size_t cat = sorted_cats[last_cat];
-        if (categories.GetValue(cat) < psu) {
-          break;
-        }
+    first_col = last_col;
+    for (; last_col < n_cats_; last_col++) {
+      if (categories.GetValue(cat_order_[last_col]) < psu) {
+        break;
+      }
     }
 
     if (psu_size <= 1.0) {
-      for (size_t cat_ki = first_cat; cat_ki < last_cat; cat_ki++) {
-        size_t cat_k = sorted_cats[cat_ki];
+      for (size_t target = 0; target < n_targets_; target++) {
+        double *target_covs = covs.data() + target * n_cells;
+
+        for (size_t col_k = first_col; col_k < last_col; col_k++) {
+          size_t cat_k = cat_order_[col_k];
 
-        covs[cat_k * (n_cats_ + 1)] = std::numeric_limits<double>::quiet_NaN();
+          target_covs[cat_k * (n_cats_ + 1)] = std::numeric_limits<double>::quiet_NaN();
 
-        for (size_t cat_li = cat_ki + 1; cat_li < n_cats_; cat_li++) {
-          size_t cat_l = sorted_cats[cat_li];
-          covs[cat_k * n_cats_ + cat_l] = std::numeric_limits<double>::quiet_NaN();
-          covs[cat_l * n_cats_ + cat_k] = std::numeric_limits<double>::quiet_NaN();
+          for (size_t col_l = col_k + 1; col_l < n_cats_; col_l++) {
+            size_t cat_l = cat_order_[col_l];
+            target_covs[cat_k * n_cats_ + cat_l] = std::numeric_limits<double>::quiet_NaN();
+            target_covs[cat_l * n_cats_ + cat_k] = std::numeric_limits<double>::quiet_NaN();
+          }
         }
       }
 
       continue;
     }
 
-    // Prepare trees and stores
-    store->maxSize = neighbours.GetValue(psu);
-    double neighbour_size_dbl = (double)neighbours.GetValue(psu);
-    KDTree *tree = new KDTree(
-      xbalance,
-      Size(),
-      p_xbalance,
-      (size_t)30,
-      KDTreeSplitMethod::midpointSlide,
-      ids.data(),
-      ids.size()
-      );
-
-
-    for (size_t i = ids.size(); i --> 0;) {
-      size_t internal_id = ids[i];
-      double *tract_balancing_data = xbalance + internal_id * p_xbalance;
-      std::fill(means.begin(), means.end(), 0.0);
+    levels.emplace_back();
+    BalancedLevel &level = levels.back();
+    level.psu = psu;
+    level.first_col = first_col;
+    level.last_col = last_col;
+    level.all_nils = all_nils;
+    level.n_rows = n_ids;
+    level.n_chunks = first_col < last_col ? std::min(n_ids, max_chunks) : 0;
+
+    // Local covariances of the pairs of the level, accumulated per chunk in
+    // column order, i.e.
+    // level.covs[((chunk * n_targets + target) * n_level_cols + (col_k - first_col)) * n_cats + col_l]
+    level.covs.assign(level.n_chunks * n_targets_ * (last_col - first_col) * n_cats_, 0.0);
+
+    level.neighbours = &level_neighbours[psu];
+  }
 
-      tree->FindNeighbours(store, tract_balancing_data);
-      Tract *tract;
+  std::vector<std::pair<size_t, size_t>> tasks; // (level, chunk)
+  for (size_t l = 0; l < levels.size(); l++) {
+    for (size_t chunk = 0; chunk < levels[l].n_chunks; chunk++) {
+      tasks.push_back(std::make_pair(l, chunk));
+    }
+  }
 
-      // Not accounting for equals
-      for (size_t j = store->GetSize(); j --> 0;) {
-        tract = FindInternal(store->neighbours[j]);
-        for (size_t cat_i = first_cat; cat_i < n_cats_; cat_i++) {
-          size_t cat = sorted_cats[cat_i];
-          means[cat] += tract->Get(cat);
+  #ifdef _OPENMP
+  #pragma omp parallel num_threads(n_threads_)
+  #endif
+  {
+    std::vector<double> means(n_targets_ * n_cats_, 0.0); // Per target and column
+    std::vector<double> unit_values(n_targets_ * n_cats_, 0.0); // Per target and column
+
+    #ifdef _OPENMP
+    #pragma omp for schedule(dynamic, 1)
+    #endif
+    for (size_t t = 0; t < tasks.size(); t++) {
+      BalancedLevel &level = levels[tasks[t].first];
+      size_t chunk = tasks[t].second;
+      size_t level_first_col = level.first_col;
+      size_t n_level_cols = level.last_col - level.first_col;
+      size_t chunk_start = level.n_rows * chunk / level.n_chunks;
+      size_t chunk_end = level.n_rows * (chunk + 1) / level.n_chunks;
+      double *chunk_covs = level.covs.data() + chunk * n_targets_ * n_level_cols * n_cats_;
+
+      for (size_t row = chunk_end; row --> chunk_start;) {
+        size_t n_neighbours = level.neighbours->GetSize(row);
+        const size_t *row_neighbours = level.neighbours->GetIds(row);
+        std::fill(means.begin(), means.end(), 0.0);
+        std::fill(unit_values.begin(), unit_values.end(), 0.0);
+
+        // Not accounting for equals
+        for (size_t j = n_neighbours; j --> 0;) {
+          size_t neighbour = row_neighbours[j];
+          for (size_t target = 0; target < n_targets_; target++) {
+            AddRowTo(neighbour, target, level_first_col, means.data() + target * n_cats_);
+          }
         }
-      }
-
-      double mean_size = (double)store->GetSize();
-      for (size_t cat_i = first_cat; cat_i < n_cats_; cat_i++) {
-        size_t cat = sorted_cats[cat_i];
-        means[cat] /= mean_size;
-      }
 
-      // Set self tract
-      tract = FindInternal(internal_id);
+        for (size_t target = 0; target < n_targets_; target++) {
+          AddRowTo(row, target, level_first_col, unit_values.data() + target * n_cats_);
+        }
 
-      for (size_t cat_ki = first_cat; cat_ki < last_cat; cat_ki++) {
-        size_t cat_k = sorted_cats[cat_ki];
+        double mean_size = (double)n_neighbours;
+        for (size_t target = 0; target < n_targets_; target++) {
+          for (size_t col = level_first_col; col < n_cats_; col++) {
+            means[target * n_cats_ + col] /= mean_size;
+          }
+        }
 
-        // If all current units are 0, the covariance of any category l is 0
-        if (all_nils[cat_k]) {
-          continue;
+        for (size_t target = 0; target < n_targets_; target++) {
+          double *target_covs = chunk_covs + target * n_level_cols * n_cats_;
+          const double *target_means = means.data() + target * n_cats_;
+          const double *target_values = unit_values.data() + target * n_cats_;
+          const unsigned char *target_nils = level.all_nils.data() + target * n_cats_;
+
+          for (size_t col_k = level_first_col; col_k < level.last_col; col_k++) {
+            // If all current units are 0, the covariance of any category l is 0
+            if (target_nils[col_k]) {
+              continue;
+            }
+
+            double dev_k = target_values[col_k] - target_means[col_k];
+            double *row_covs = target_covs + (col_k - level_first_col) * n_cats_;
+
+            for (size_t col_l = col_k; col_l < n_cats_; col_l++) {
+              // If all current units are 0, the covariance of any category l is 0
+              if (target_nils[col_l]) {
+                continue;
+              }
+
+              // Upper triangular id
+              row_covs[col_l] += dev_k * (target_values[col_l] - target_means[col_l]);
+            }
+          }
         }
+      }
+    }
+  }
 
-        for (size_t cat_li = cat_ki; cat_li < n_cats_; cat_li++) {
-          size_t cat_l = sorted_cats[cat_li];
+  for (size_t l = 0; l < levels.size(); l++) {
+    BalancedLevel &level = levels[l];
+    size_t n_level_cols = level.last_col - level.first_col;
+    size_t n_level_cells = n_targets_ * n_level_cols * n_cats_;
+    double psu_size = (double)psus.GetValue(level.psu);
+    double neighbour_size_dbl = (double)neighbours.GetValue(level.psu);
 
-          // If all current units are 0, the covariance of any category l is 0
-          if (all_nils[cat_l]) {
-            continue;
-          }
+    // Reduce the chunks in order
+    for (size_t chunk = 1; chunk < level.n_chunks; chunk++) {
+      const double *chunk_covs = level.covs.data() + chunk * n_level_cells;
 
-          // Upper triangular id
-          size_t covs_index = cat_k * n_cats_ + cat_l;
-          covs[covs_index] +=
-            (tract->Get(cat_k) - means[cat_k]) *
-            (tract->Get(cat_l) - means[cat_l]);
-        }
+      for (size_t k = 0; k < n_level_cells; k++) {
+        level.covs[k] += chunk_covs[k];
       }
     }
 
+    for (size_t target = 0; target < n_targets_; target++) {
+      double *target_covs = covs.data() + target * n_cells;
+      const double *target_level_covs = level.covs.data() + target * n_level_cols * n_cats_;
+
+      for (size_t col_k = level.first_col; col_k < level.last_col; col_k++) {
+        size_t cat_k = cat_order_[col_k];
+        for (size_t col_l = col_k; col_l < n_cats_; col_l++) {
+          size_t cat_l = cat_order_[col_l];
+          size_t psu_larger = categories.GetValueUnchecked(cat_l);
+          double psu_size_larger = (double)psus.GetValueUnchecked(psu_larger);
+          double cov = target_level_covs[(col_k - level.first_col) * n_cats_ + col_l] *
+            (area / psu_size) *
+            (area / psu_size_larger) *
+            (neighbour_size_dbl / (neighbour_size_dbl - 1.0));
 
-    for (size_t cat_ki = first_cat; cat_ki < last_cat; cat_ki++) {
-      size_t cat_k = sorted_cats[cat_ki];
-      for (size_t cat_li = cat_ki; cat_li < n_cats_; cat_li++) {
-        size_t cat_l = sorted_cats[cat_li];
-        size_t psu_larger = categories.GetValue(cat_l);
-        double psu_size_larger = (double)psus.GetValue(psu_larger);
-        // Upper triangular id
-        size_t covs_index = cat_k * n_cats_ + cat_l;
-        covs[covs_index] *=
-          (area / psu_size) *
-          (area / psu_size_larger) *
-          (neighbour_size_dbl / (neighbour_size_dbl - 1.0));
+          // Upper triangular id
+          target_covs[cat_k * n_cats_ + cat_l] = cov;
 
-        if (cat_l != cat_k) {
-          covs[cat_l * n_cats_ + cat_k] = covs[covs_index];
+          if (cat_l != cat_k) {
+            target_covs[cat_l * n_cats_ + cat_k] = cov;
+          }
         }
       }
     }
-
-    delete tree;
   }
 
-  delete store;
   return covs;
 }
@@ -2,57 +2,211 @@
 #define TRACTSTORE_HEADER
 
 #include <stddef.h>
-#include <unordered_map>
 #include <vector>
 
-#include <Rcpp.h>
-
+#include "KDFlatTreeClass.h"
+#include "KDNeighboursClass.h"
+#include "KeyIndex.h"
 #include "KeyValueMap.h"
 
-class Tract {
+// Plot level data, one row per plot: tract id, category, weight, and one value
+// column per target variable. Optionally, the (0-based) domain of each plot.
+class PlotData {
+public:
+  const int *tract_ids_ = nullptr;
+  const int *cats_ = nullptr;
+  const double *weights_ = nullptr;
+  std::vector<const double*> values_;
+  const int *domains_ = nullptr;
+  size_t n_domains_ = 1;
+  size_t size_ = 0;
+
+  PlotData(const int*, const int*, const double*, const size_t);
+  void AddValues(const double*);
+  void SetDomains(const int*, const size_t);
+  size_t Size() const;
+  size_t NumVars() const;
+  size_t NumDomains() const;
+  size_t GetDomain(const size_t) const;
+};
+
+// Diagnostics of the plots ignored by TractStore::Fill. The (1-based) rows of
+// the ignored plots are kept, up to max_rows_ per kind of issue. If fail_fast_
+// is set, the first issue throws instead.
+class FillDiagnostics {
 public:
-  std::vector<double> values_;
-  int external_id_;
-  size_t internal_psu_;
-  bool recorded_ = false;
-  bool nonnil_ = false;
+  bool fail_fast_ = false;
+  size_t max_rows_ = 100;
+  size_t n_missing_tracts_ = 0;
+  size_t n_psu_mismatches_ = 0;
+  std::vector<size_t> missing_tract_rows_;
+  std::vector<size_t> psu_mismatch_rows_;
+
+  FillDiagnostics();
+  FillDiagnostics(const bool);
+  void AddMissingTract(const size_t, const int);
+  void AddPsuMismatch(const size_t, const int);
+  size_t NumIssues() const;
+};
+
+// The state of a plot in TractStore::Fill
+enum class PlotStatus {
+  used = 0,
+  nil = 1,
+  missing_tract = 2,
+  psu_mismatch = 3,
+  bad_category = 4,
+  bad_domain = 5
+};
+
+// A non-zero cell of a tract, used when filling the sparse storage
+struct TractCell {
+  size_t target;
+  size_t col;
+  double value;
+};
 
-  Tract(const size_t, const int, const size_t);
-  void Add(const size_t, const double);
-  double Get(const size_t) const;
-  double Sum() const;
+// The index used for the neighbour searches of TractStore::FindBalancedNeighbours
+enum class NeighbourIndex {
+  kdTree = 0,
+  grid = 1,
+  ballTree = 2
+};
 
-  size_t GetInternalPsu() const;
+// The settings of the neighbour searches of TractStore::FindBalancedNeighbours,
+// and the index used, the number of tracts searched, and of nodes and leaves
+// (cells of a grid) visited by the searches. An index of -1, a bucket size of
+// 0, or a split method of -1, is chosen automatically. The bucket size applies
+// to the trees, and the split method to the k-d tree. The searches are exact
+// if eps_ = 0 and max_leaves_ = 0.
+class NeighbourSearch {
+public:
+  int index_ = -1; // NeighbourIndex
+  size_t bucket_size_ = 30;
+  int split_method_ = 2; // KDTreeSplitMethod
+  double eps_ = 0.0;
+  size_t max_leaves_ = 0; // 0 for no limit
+  NeighbourIndex used_index_ = NeighbourIndex::kdTree;
+  size_t n_searches_ = 0;
+  size_t n_visited_nodes_ = 0;
+  size_t n_visited_leaves_ = 0;
 };
 
-using TractInternalId = std::unordered_map<int, size_t>;
+// A PSU level of TractStore::VarianceBalanced, with the neighbourhoods of the
+// tracts of the level, i.e. of the rows [0, n_rows), and the accumulators of
+// the local covariances per chunk of tracts
+class BalancedLevel {
+public:
+  size_t psu;
+  size_t first_col;
+  size_t last_col;
+  size_t n_rows;
+  size_t n_chunks;
+  std::vector<unsigned char> all_nils;
+  const KDNeighbours *neighbours = nullptr;
+  std::vector<double> covs;
+};
 
+enum class TractStorage {
+  dense = 0,
+  sparse = 1
+};
+
+// The tract values are stored in one contiguous, column major, tracts x
+// categories matrix per target, i.e.
+//   values_[(target * n_cats + col) * n_tracts + row],
+// where a target is a variable within a domain.
+// The rows (tracts) are ordered by PSU, and the columns (categories) by the PSU
+// of the category, smallest PSU first. Thus, the rows and columns of a PSU
+// level follows those of all smaller levels, and the sample of a PSU level is
+// the prefix [0, LevelEnd(psu)) of the rows.
+// In sparse storage, only the non-zero cells are kept, in compressed sparse row
+// form with one row per target and tract, i.e. the cells of row `row` of target
+// `target` are found at positions
+//   [sparse_offsets_[target * n_tracts + row], sparse_offsets_[target * n_tracts + row + 1])
+// of sparse_cols_ and sparse_values_, ordered by column.
+// A store created without targets holds only the order of the tracts and
+// categories. It can be copied, and the copies allocated by Allocate, so that
+// the order is prepared once for several sets of plots.
 class TractStore {
 public:
-  std::vector<Tract> tract_map_;
-  TractInternalId internal_id_map_; // Maps external -> internal ids
+  TractStorage storage_;
+  std::vector<double> values_; // Dense storage only
+  std::vector<size_t> sparse_offsets_; // Sparse storage only
+  std::vector<size_t> sparse_cols_; // Sparse storage only
+  std::vector<double> sparse_values_; // Sparse storage only
+  std::vector<unsigned char> nonnil_; // Per target and row, [target * n_tracts + row]
+  std::vector<int> external_ids_; // Per row
+  std::vector<size_t> internal_psus_; // Per row
+  std::vector<size_t> input_rows_; // Per row, the position of the tract in the input
+  std::vector<size_t> level_ends_; // Per internal psu, the end of the rows of the psu
+  std::vector<size_t> cat_order_; // Maps column -> internal category
+  std::vector<size_t> cat_columns_; // Maps internal category -> column
+  KeyIndex row_index_; // Maps external id -> row
+  size_t n_tracts_;
   size_t n_cats_;
+  size_t n_domains_ = 0;
+  size_t n_targets_ = 0; // n_vars * n_domains
+  size_t n_threads_ = 1;
+
+  TractStore(
+    const int*,
+    const int*,
+    const size_t,
+    const KeyValueMap&,
+    const KeyValueMap&
+  );
+  TractStore(
+    const int*,
+    const int*,
+    const size_t,
+    const KeyValueMap&,
+    const KeyValueMap&,
+    const size_t,
+    const size_t,
+    const TractStorage
+  );
 
-  TractStore(const int*, const int*, const size_t, const KeyValueMap&, const size_t);
+  void Allocate(const size_t, const size_t, const TractStorage);
 
-  Tract* FindInternal(const size_t);
-  Tract* FindExternal(const int);
+  static TractStorage ChooseStorage(const size_t, const size_t, const size_t);
+
+  void SetThreads(const size_t);
+  bool FindExternal(const int, size_t*) const;
+  void FindExternalAll(const int*, const size_t, size_t*) const;
   size_t Size() const;
+  size_t NumTargets() const;
+
+  double Get(const size_t, const size_t, const size_t) const;
+  void Add(const size_t, const size_t, const size_t, const double);
+  const double* Column(const size_t, const size_t) const;
+  void AddRowTo(const size_t, const size_t, const size_t, double*) const;
+  bool NonNil(const size_t, const size_t) const;
+  size_t GetInternalPsu(const size_t) const;
+  size_t LevelEnd(const size_t) const;
 
-  void Fill(const Rcpp::DataFrame&, const KeyValueMap&, const double);
+  void Fill(const PlotData&, const KeyValueMap&, const double, FillDiagnostics&);
 
-  int NonNilTracts();
+  std::vector<int> NonNilTracts();
   std::vector<int> PositiveTractsPerCat();
   std::vector<double> CatEstimates(const KeyValueMap&, const KeyValueMap&, const double);
 
   std::vector<double> Variance(const KeyValueMap&, const KeyValueMap&, const double);
+  std::vector<double> VarianceSparse(const KeyValueMap&, const KeyValueMap&, const double);
 
-  std::vector<double> VarianceBalanced(
+  std::vector<KDNeighbours> FindBalancedNeighbours(
     const KeyValueMap&,
     const KeyValueMap&,
-    const double,
     double*,
     const size_t,
+    const KeyValueMap&,
+    NeighbourSearch&
+  ) const;
+  std::vector<double> VarianceBalanced(
+    const KeyValueMap&,
+    const KeyValueMap&,
+    const double,
+    const std::vector<KDNeighbours>&,
     const KeyValueMap&
   );
 };
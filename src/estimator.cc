@@ -1,11 +1,15 @@
 #include <cmath>
+#include <memory>
 #include <stddef.h>
 #include <stdexcept>
+#include <string>
 #include <vector>
 
 #include <Rcpp.h>
 
+#include "KDGridClass.h"
 #include "KeyValueMap.h"
+#include "NilsDesign.h"
 #include "TractStore.h"
 
 KeyValueMap CreatePsuKeyValueMap(const Rcpp::IntegerMatrix &mat) {
@@ -63,7 +67,7 @@ KeyValueMap CreateNeighboursKeyValueMap(
   }
 
   int *rptr = INTEGER(mat) + n * 2;
-  KeyValueMap map(psus.keys_, n);
+  KeyValueMap map(psus.keys_.data(), n);
 
   for (size_t i = 0; i < n; i++) {
     int external_value = rptr[i];
@@ -102,9 +106,44 @@ KeyValueMap CreateTranslatedKeyValueMap(
   return map;
 }
 
-double Sum(const std::vector<double> &vec) {
+PlotData CreatePlotData(
+  const Rcpp::DataFrame &data,
+  const Rcpp::IntegerVector &domains,
+  const int n_domains
+) {
+  if (data.size() < 4) {
+    throw std::range_error("(CreatePlotData) ncol < 4");
+  }
+
+  Rcpp::IntegerVector tract_ids = data[0];
+  Rcpp::IntegerVector cats = data[1];
+  Rcpp::NumericVector weights = data[2];
+  PlotData plots(tract_ids.begin(), cats.begin(), weights.begin(), data.nrows());
+
+  for (int k = 3; k < data.size(); k++) {
+    Rcpp::NumericVector values = data[k];
+    plots.AddValues(values.begin());
+  }
+
+  if (n_domains < 1) {
+    throw std::range_error("(CreatePlotData) n_domains < 1");
+  }
+
+  // An empty domain vector means that all plots belong to one single domain
+  if (domains.size() > 0) {
+    if ((int)domains.size() != data.nrows()) {
+      throw std::range_error("(CreatePlotData) length of domains != nrow");
+    }
+
+    plots.SetDomains(domains.begin(), (size_t)n_domains);
+  }
+
+  return plots;
+}
+
+double Sum(const double *vec, const size_t n) {
   double tot = 0.0;
-  for (size_t k = vec.size(); k --> 0;) {
+  for (size_t k = n; k --> 0;) {
     if (!std::isnan(vec[k])) {
       tot += vec[k];
     }
@@ -112,41 +151,241 @@ double Sum(const std::vector<double> &vec) {
   return tot;
 }
 
-// [[Rcpp::export(.NilsEstimate)]]
-Rcpp::List NilsEstimate(
-  const Rcpp::IntegerMatrix &r_ordered_psu_size, // PSU, SIZE
+/*
+ * Create one result list per target from the target blocks returned by the
+ * TractStore, i.e. ordered by variable, then domain
+ */
+Rcpp::List CreateResultLists(
+  const std::vector<double> &estimates,
+  const std::vector<double> &covmat,
+  const std::vector<int> &nonnil_tracts,
+  const std::vector<int> &positive_tracts,
+  const size_t n_cats
+) {
+  size_t n_targets = nonnil_tracts.size();
+  size_t n_cells = n_cats * n_cats;
+  Rcpp::List ret(n_targets);
+
+  for (size_t target = 0; target < n_targets; target++) {
+    const double *target_estimates = estimates.data() + target * n_cats;
+    const double *target_covmat = covmat.data() + target * n_cells;
+    const int *target_positive = positive_tracts.data() + target * n_cats;
+
+    ret[target] = Rcpp::List::create(
+      Rcpp::Named("estimate") = Sum(target_estimates, n_cats),
+      Rcpp::Named("variance") = Sum(target_covmat, n_cells),
+      Rcpp::Named("cat_estimates") = Rcpp::NumericVector(target_estimates, target_estimates + n_cats),
+      Rcpp::Named("cat_covmat") = Rcpp::NumericMatrix(n_cats, n_cats, target_covmat),
+      Rcpp::Named("nonnil_tracts") = nonnil_tracts[target],
+      Rcpp::Named("positive_tracts_per_cat") = Rcpp::IntegerVector(target_positive, target_positive + n_cats)
+    );
+  }
+
+  return ret;
+}
+
+/*
+ * Create the list of the settings and visited nodes of the neighbour searches
+ * of TractStore::FindBalancedNeighbours
+ */
+Rcpp::List CreateNeighbourSearchList(const NeighbourSearch &search) {
+  const char *indices[] = {"kd_tree", "grid", "ball_tree"};
+
+  return Rcpp::List::create(
+    Rcpp::Named("index") = std::string(indices[(int)search.used_index_]),
+    Rcpp::Named("eps") = search.eps_,
+    Rcpp::Named("max_leaves") = (double)search.max_leaves_,
+    Rcpp::Named("searches") = (double)search.n_searches_,
+    Rcpp::Named("visited_nodes") = (double)search.n_visited_nodes_,
+    Rcpp::Named("visited_leaves") = (double)search.n_visited_leaves_
+  );
+}
+
+/*
+ * Create the list of diagnostics of the plots ignored by TractStore::Fill
+ */
+Rcpp::List CreateDiagnosticsList(const FillDiagnostics &diagnostics) {
+  return Rcpp::List::create(
+    Rcpp::Named("missing_tracts") = (int)diagnostics.n_missing_tracts_,
+    Rcpp::Named("missing_tract_rows") = Rcpp::IntegerVector(
+      diagnostics.missing_tract_rows_.begin(),
+      diagnostics.missing_tract_rows_.end()
+    ),
+    Rcpp::Named("psu_mismatches") = (int)diagnostics.n_psu_mismatches_,
+    Rcpp::Named("psu_mismatch_rows") = Rcpp::IntegerVector(
+      diagnostics.psu_mismatch_rows_.begin(),
+      diagnostics.psu_mismatch_rows_.end()
+    )
+  );
+}
+
+/*
+ * Create the settings of the neighbour searches of TractStore::FindBalancedNeighbours
+ */
+NeighbourSearch CreateNeighbourSearch(
+  const int bucket_size, // 0 for automatic
+  const int split_method, // KDTreeSplitMethod, or -1 for automatic
+  const double eps, // 0 for exact searches
+  const int max_leaves, // 0 for no limit
+  const int neighbour_index, // NeighbourIndex, or -1 for automatic
+  const size_t p_xbalance
+) {
+  if (bucket_size < 0) {
+    throw std::range_error("(CreateNeighbourSearch) bucket_size < 0");
+  }
+
+  if (split_method < -1 || split_method > 2) {
+    throw std::range_error("(CreateNeighbourSearch) split_method does not exist");
+  }
+
+  if (!(eps >= 0.0)) {
+    throw std::range_error("(CreateNeighbourSearch) eps < 0");
+  }
+
+  if (max_leaves < 0) {
+    throw std::range_error("(CreateNeighbourSearch) max_leaves < 0");
+  }
+
+  if (neighbour_index < -1 || neighbour_index > 2) {
+    throw std::range_error("(CreateNeighbourSearch) neighbour_index does not exist");
+  }
+
+  if (neighbour_index == (int)NeighbourIndex::grid && p_xbalance > KDGrid::maxDimensions) {
+    throw std::range_error("(CreateNeighbourSearch) the grid index needs at most 3 auxiliaries");
+  }
+
+  NeighbourSearch search;
+  search.index_ = neighbour_index;
+  search.bucket_size_ = (size_t)bucket_size;
+  search.split_method_ = split_method;
+  search.eps_ = eps;
+  search.max_leaves_ = (size_t)max_leaves;
+
+  return search;
+}
+
+/*
+ * Create a design from the psus, categories and tracts
+ */
+std::unique_ptr<NilsDesign> CreateDesign(
+  const Rcpp::IntegerMatrix &r_ordered_psu_size, // PSU, SIZE[, NEIGHBOURS]
   const Rcpp::IntegerMatrix &r_cat_psu, // CAT, PSU
   const Rcpp::IntegerMatrix &r_tracts, // ID, PSU
-  const Rcpp::DataFrame &r_plot_data, // TractID, CAT, WEIGHT, VAL
   const double area,
-  const double tract_area // 196*100*pi
+  const double tract_area
 ) {
-  // Prepare maps
   KeyValueMap psus = CreatePsuKeyValueMap(r_ordered_psu_size);
   KeyValueMap categories = CreateTranslatedKeyValueMap(r_cat_psu, psus);
 
-  // Fill TractStore with values from plots
   int *tract_arr = INTEGER(r_tracts);
   size_t n_tracts = r_tracts.nrow();
-  TractStore tract_store(tract_arr, tract_arr + n_tracts, n_tracts, psus, categories.Size());
-  tract_store.Fill(r_plot_data, categories, tract_area);
+
+  return std::unique_ptr<NilsDesign>(new NilsDesign(
+    tract_arr,
+    tract_arr + n_tracts,
+    n_tracts,
+    psus,
+    categories,
+    area,
+    tract_area
+  ));
+}
+
+/*
+ * Estimate the totals of the plots, and their variances, using a prepared
+ * design. The balanced variance uses the neighbourhoods of the design.
+ */
+Rcpp::List EstimateWithDesign(
+  const NilsDesign &design,
+  const Rcpp::DataFrame &r_plot_data, // TractID, CAT, WEIGHT, VAL[, VAL ...]
+  const Rcpp::IntegerVector &r_domains, // DOMAIN per plot, or empty
+  const int n_domains,
+  const bool fail_fast,
+  const int threads,
+  const bool balanced
+) {
+  if (balanced && !design.IsBalanced()) {
+    throw std::range_error("(EstimateWithDesign) the design has no auxiliaries");
+  }
+
+  PlotData plots = CreatePlotData(r_plot_data, r_domains, n_domains);
+
+  // Fill TractStore with values from plots
+  TractStore tract_store = design.CreateTractStore(
+    plots.NumVars(),
+    plots.NumDomains(),
+    plots.Size(),
+    threads > 0 ? (size_t)threads : 1
+  );
+
+  FillDiagnostics diagnostics(fail_fast);
+  tract_store.Fill(plots, design.categories_, design.tract_area_, diagnostics);
 
   // Calcualte estimate and variance estimate
-  std::vector<double> estimates = tract_store.CatEstimates(psus, categories, area);
-  std::vector<double> covmat = tract_store.Variance(psus, categories, area);
-  double estimate = Sum(estimates);
-  double variance = Sum(covmat);
+  std::vector<double> estimates = tract_store.CatEstimates(
+    design.psus_,
+    design.categories_,
+    design.area_
+  );
 
-  Rcpp::List ret = Rcpp::List::create(
-    Rcpp::Named("estimate") = estimate,
-    Rcpp::Named("variance") = variance,
-    Rcpp::Named("cat_estimates") = Rcpp::wrap(estimates),
-    Rcpp::Named("cat_covmat") = Rcpp::NumericMatrix(categories.Size(), categories.Size(), covmat.begin()),
-    Rcpp::Named("nonnil_tracts") = tract_store.NonNilTracts(),
-    Rcpp::Named("positive_tracts_per_cat") = Rcpp::wrap(tract_store.PositiveTractsPerCat())
+  if (!balanced) {
+    std::vector<double> covmat = tract_store.Variance(design.psus_, design.categories_, design.area_);
+
+    return Rcpp::List::create(
+      Rcpp::Named("estimates") = CreateResultLists(
+        estimates,
+        covmat,
+        tract_store.NonNilTracts(),
+        tract_store.PositiveTractsPerCat(),
+        design.categories_.Size()
+      ),
+      Rcpp::Named("diagnostics") = CreateDiagnosticsList(diagnostics)
+    );
+  }
+
+  std::vector<double> covmat = tract_store.VarianceBalanced(
+    design.psus_,
+    design.categories_,
+    design.area_,
+    design.level_neighbours_,
+    design.neighbours_
   );
 
-  return ret;
+  return Rcpp::List::create(
+    Rcpp::Named("estimates") = CreateResultLists(
+      estimates,
+      covmat,
+      tract_store.NonNilTracts(),
+      tract_store.PositiveTractsPerCat(),
+      design.categories_.Size()
+    ),
+    Rcpp::Named("diagnostics") = CreateDiagnosticsList(diagnostics),
+    Rcpp::Named("neighbour_search") = CreateNeighbourSearchList(design.search_)
+  );
+}
+
+// [[Rcpp::export(.NilsEstimate)]]
+Rcpp::List NilsEstimate(
+  const Rcpp::IntegerMatrix &r_ordered_psu_size, // PSU, SIZE
+  const Rcpp::IntegerMatrix &r_cat_psu, // CAT, PSU
+  const Rcpp::IntegerMatrix &r_tracts, // ID, PSU
+  const Rcpp::DataFrame &r_plot_data, // TractID, CAT, WEIGHT, VAL[, VAL ...]
+  const Rcpp::IntegerVector &r_domains, // DOMAIN per plot, or empty
+  const int n_domains,
+  const double area,
+  const double tract_area, // 196*100*pi
+  const bool fail_fast,
+  const int threads
+) {
+  std::unique_ptr<NilsDesign> design = CreateDesign(
+    r_ordered_psu_size,
+    r_cat_psu,
+    r_tracts,
+    area,
+    tract_area
+  );
+
+  return EstimateWithDesign(*design, r_plot_data, r_domains, n_domains, fail_fast, threads, false);
 }
 
 // [[Rcpp::export(.NilsBalancedEstimate)]]
@@ -154,43 +393,143 @@ Rcpp::List NilsBalancedEstimate(
   const Rcpp::IntegerMatrix &r_ordered_psu_size, // PSU, SIZE, NEIGHBOURS
   const Rcpp::IntegerMatrix &r_cat_psu, // CAT, PSU
   const Rcpp::IntegerMatrix &r_tracts, // ID, PSU
-  const Rcpp::DataFrame &r_plot_data, // TractID, CAT, WEIGHT, VAL
+  const Rcpp::DataFrame &r_plot_data, // TractID, CAT, WEIGHT, VAL[, VAL ...]
+  const Rcpp::IntegerVector &r_domains, // DOMAIN per plot, or empty
+  const int n_domains,
   const double area,
   const double tract_area, // 196*100*pi
-  Rcpp::NumericMatrix &r_xbalance
+  const bool fail_fast,
+  const int threads,
+  Rcpp::NumericMatrix &r_xbalance,
+  const int bucket_size, // 0 for automatic
+  const int split_method, // KDTreeSplitMethod, or -1 for automatic
+  const double eps, // 0 for exact searches
+  const int max_leaves, // 0 for no limit
+  const int neighbour_index // NeighbourIndex, or -1 for automatic
 ) {
-  // Prepare maps
-  KeyValueMap psus = CreatePsuKeyValueMap(r_ordered_psu_size);
-  KeyValueMap neighbours = CreateNeighboursKeyValueMap(r_ordered_psu_size, psus);
-  KeyValueMap categories = CreateTranslatedKeyValueMap(r_cat_psu, psus);
+  NeighbourSearch search = CreateNeighbourSearch(
+    bucket_size,
+    split_method,
+    eps,
+    max_leaves,
+    neighbour_index,
+    r_xbalance.nrow()
+  );
 
-  // Fill TractStore with values from plots
-  int *tract_arr = INTEGER(r_tracts);
-  size_t n_tracts = r_tracts.nrow();
-  TractStore tract_store(tract_arr, tract_arr + n_tracts, n_tracts, psus, categories.Size());
-  tract_store.Fill(r_plot_data, categories, tract_area);
+  std::unique_ptr<NilsDesign> design = CreateDesign(
+    r_ordered_psu_size,
+    r_cat_psu,
+    r_tracts,
+    area,
+    tract_area
+  );
 
-  // Calcualte estimate and variance estimate
-  std::vector<double> estimates = tract_store.CatEstimates(psus, categories, area);
-  std::vector<double> covmat = tract_store.VarianceBalanced(
-    psus,
-    categories,
+  design->SetBalancing(
+    REAL(r_xbalance),
+    r_xbalance.nrow(),
+    CreateNeighboursKeyValueMap(r_ordered_psu_size, design->psus_),
+    search,
+    threads > 0 ? (size_t)threads : 1
+  );
+
+  return EstimateWithDesign(*design, r_plot_data, r_domains, n_domains, fail_fast, threads, true);
+}
+
+// The tag of the external pointers to NilsDesign, checked before they are cast
+SEXP NilsDesignTag() {
+  return Rf_install("NilsDesign");
+}
+
+// [[Rcpp::export(.NilsDesign)]]
+Rcpp::List NilsDesignCreate(
+  const Rcpp::IntegerMatrix &r_ordered_psu_size, // PSU, SIZE
+  const Rcpp::IntegerMatrix &r_cat_psu, // CAT, PSU
+  const Rcpp::IntegerMatrix &r_tracts, // ID, PSU
+  const double area,
+  const double tract_area // 196*100*pi
+) {
+  std::unique_ptr<NilsDesign> design = CreateDesign(
+    r_ordered_psu_size,
+    r_cat_psu,
+    r_tracts,
+    area,
+    tract_area
+  );
+
+  return Rcpp::List::create(
+    Rcpp::Named("pointer") = Rcpp::XPtr<NilsDesign>(design.release(), true, NilsDesignTag())
+  );
+}
+
+// [[Rcpp::export(.NilsBalancedDesign)]]
+Rcpp::List NilsBalancedDesignCreate(
+  const Rcpp::IntegerMatrix &r_ordered_psu_size, // PSU, SIZE, NEIGHBOURS
+  const Rcpp::IntegerMatrix &r_cat_psu, // CAT, PSU
+  const Rcpp::IntegerMatrix &r_tracts, // ID, PSU
+  const double area,
+  const double tract_area, // 196*100*pi
+  const int threads,
+  Rcpp::NumericMatrix &r_xbalance,
+  const int bucket_size, // 0 for automatic
+  const int split_method, // KDTreeSplitMethod, or -1 for automatic
+  const double eps, // 0 for exact searches
+  const int max_leaves, // 0 for no limit
+  const int neighbour_index // NeighbourIndex, or -1 for automatic
+) {
+  NeighbourSearch search = CreateNeighbourSearch(
+    bucket_size,
+    split_method,
+    eps,
+    max_leaves,
+    neighbour_index,
+    r_xbalance.nrow()
+  );
+
+  std::unique_ptr<NilsDesign> design = CreateDesign(
+    r_ordered_psu_size,
+    r_cat_psu,
+    r_tracts,
     area,
+    tract_area
+  );
+
+  design->SetBalancing(
     REAL(r_xbalance),
     r_xbalance.nrow(),
-    neighbours
+    CreateNeighboursKeyValueMap(r_ordered_psu_size, design->psus_),
+    search,
+    threads > 0 ? (size_t)threads : 1
   );
-  double estimate = Sum(estimates);
-  double variance = Sum(covmat);
 
-  Rcpp::List ret = Rcpp::List::create(
-    Rcpp::Named("estimate") = estimate,
-    Rcpp::Named("variance") = variance,
-    Rcpp::Named("cat_estimates") = Rcpp::wrap(estimates),
-    Rcpp::Named("cat_covmat") = Rcpp::NumericMatrix(categories.Size(), categories.Size(), covmat.begin()),
-    Rcpp::Named("nonnil_tracts") = tract_store.NonNilTracts(),
-    Rcpp::Named("positive_tracts_per_cat") = Rcpp::wrap(tract_store.PositiveTractsPerCat())
+  Rcpp::List neighbour_search = CreateNeighbourSearchList(design->search_);
+
+  return Rcpp::List::create(
+    Rcpp::Named("pointer") = Rcpp::XPtr<NilsDesign>(design.release(), true, NilsDesignTag()),
+    Rcpp::Named("neighbour_search") = neighbour_search
   );
+}
 
-  return ret;
+// [[Rcpp::export(.NilsDesignEstimate)]]
+Rcpp::List NilsDesignEstimate(
+  SEXP r_design, // External pointer to a NilsDesign
+  const Rcpp::DataFrame &r_plot_data, // TractID, CAT, WEIGHT, VAL[, VAL ...]
+  const Rcpp::IntegerVector &r_domains, // DOMAIN per plot, or empty
+  const int n_domains,
+  const bool fail_fast,
+  const int threads,
+  const bool balanced
+) {
+  if (TYPEOF(r_design) != EXTPTRSXP || R_ExternalPtrTag(r_design) != NilsDesignTag()) {
+    throw std::range_error("(NilsDesignEstimate) the design is not a pointer to a NilsDesign");
+  }
+
+  Rcpp::XPtr<NilsDesign> design_ptr(r_design);
+  NilsDesign *design = design_ptr.get();
+
+  // The pointer is cleared when the design is saved and loaded
+  if (design == nullptr) {
+    throw std::range_error("(NilsDesignEstimate) the design is no longer available, and must be recreated");
+  }
+
+  return EstimateWithDesign(*design, r_plot_data, r_domains, n_domains, fail_fast, threads, balanced);
 }
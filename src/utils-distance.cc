@@ -0,0 +1,139 @@
+#include <stddef.h>
+
+#include "utils-distance.h"
+
+#if defined(__GNUC__) || defined(__clang__)
+#define DISTANCE_INLINE inline __attribute__((always_inline))
+#else
+#define DISTANCE_INLINE inline
+#endif
+
+// The AVX2 kernels are only built by GCC and Clang on x86-64. They are not
+// built by mingw, which does not align the stack for spilled AVX registers.
+#if (defined(__GNUC__) || defined(__clang__)) && defined(__x86_64__) && !defined(__MINGW32__)
+#define DISTANCE_AVX2 1
+#include <immintrin.h>
+#endif
+
+// Generic kernels, with the number of dimensions known at compile time (P > 0)
+// or at runtime (P == 0)
+template <size_t P>
+DISTANCE_INLINE void BlockDistancesGeneric(
+  const double* unit,
+  const double* block,
+  const size_t stride,
+  const size_t n,
+  const size_t t_p,
+  double* distances
+) {
+  const size_t p = P > 0 ? P : t_p;
+
+  for (size_t j = 0; j < n; j++)
+    distances[j] = 0.0;
+
+  for (size_t k = 0; k < p; k++) {
+    const double u = unit[k];
+    const double* col = block + k * stride;
+
+    for (size_t j = 0; j < n; j++) {
+      double temp = u - col[j];
+      distances[j] += temp * temp;
+    }
+  }
+}
+
+#ifdef DISTANCE_AVX2
+// AVX2 kernels, four points at a time, keeping the distances in registers over
+// all dimensions. No fused multiply-add is used, so that the results are
+// identical to those of the generic kernels.
+template <size_t P>
+__attribute__((target("avx2"))) DISTANCE_INLINE void BlockDistancesAvx2(
+  const double* unit,
+  const double* block,
+  const size_t stride,
+  const size_t n,
+  const size_t t_p,
+  double* distances
+) {
+  const size_t p = P > 0 ? P : t_p;
+  size_t j = 0;
+
+  for (; j + 4 <= n; j += 4) {
+    __m256d acc = _mm256_setzero_pd();
+
+    for (size_t k = 0; k < p; k++) {
+      __m256d temp = _mm256_sub_pd(_mm256_set1_pd(unit[k]), _mm256_loadu_pd(block + k * stride + j));
+      acc = _mm256_add_pd(acc, _mm256_mul_pd(temp, temp));
+    }
+
+    _mm256_storeu_pd(distances + j, acc);
+  }
+
+  for (; j < n; j++) {
+    double distance = 0.0;
+
+    for (size_t k = 0; k < p; k++) {
+      double temp = unit[k] - block[k * stride + j];
+      distance += temp * temp;
+    }
+
+    distances[j] = distance;
+  }
+}
+
+__attribute__((target("avx2"))) static void BlockDistancesAvx2Dispatch(
+  const double* unit,
+  const double* block,
+  const size_t stride,
+  const size_t n,
+  const size_t p,
+  double* distances
+) {
+  switch (p) {
+  case 2:
+    BlockDistancesAvx2<2>(unit, block, stride, n, p, distances);
+    return;
+  case 12:
+    BlockDistancesAvx2<12>(unit, block, stride, n, p, distances);
+    return;
+  default:
+    BlockDistancesAvx2<0>(unit, block, stride, n, p, distances);
+    return;
+  }
+}
+
+static bool CpuHasAvx2() {
+  __builtin_cpu_init();
+  return __builtin_cpu_supports("avx2");
+}
+
+static const bool cpuHasAvx2 = CpuHasAvx2();
+#endif
+
+void BlockDistances(
+  const double* unit,
+  const double* block,
+  const size_t stride,
+  const size_t n,
+  const size_t p,
+  double* distances
+) {
+#ifdef DISTANCE_AVX2
+  if (cpuHasAvx2) {
+    BlockDistancesAvx2Dispatch(unit, block, stride, n, p, distances);
+    return;
+  }
+#endif
+
+  switch (p) {
+  case 2:
+    BlockDistancesGeneric<2>(unit, block, stride, n, p, distances);
+    return;
+  case 12:
+    BlockDistancesGeneric<12>(unit, block, stride, n, p, distances);
+    return;
+  default:
+    BlockDistancesGeneric<0>(unit, block, stride, n, p, distances);
+    return;
+  }
+}
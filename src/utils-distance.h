@@ -0,0 +1,21 @@
+#ifndef UTILSDISTANCE_HEADER
+#define UTILSDISTANCE_HEADER
+
+#include <stddef.h>
+
+// Squared euclidean distances between one unit and a block of n points, stored
+// dimension major with a stride between the dimensions, i.e. coordinate k of
+// point j is block[k * stride + j]. The distances are summed over the
+// dimensions in order, thus all kernels give identical results.
+// The kernel is specialised for p = 2 and p = 12, and uses AVX2 on x86-64 if
+// the CPU supports it.
+void BlockDistances(
+  const double* unit,
+  const double* block,
+  const size_t stride,
+  const size_t n,
+  const size_t p,
+  double* distances
+);
+
+#endif